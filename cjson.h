@@ -1,8 +1,16 @@
 #ifndef CJSON_H
 #define CJSON_H
 
+// The POSIX functions the implementation uses are only declared if this is
+// defined before the first system header
+#if defined(CJSON_IMPLEMENTATION) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif /* CJSON_IMPLEMENTATION && ! _POSIX_C_SOURCE */
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef struct cjson_element cjson_element;
 
@@ -26,13 +34,17 @@ cjson_element *cjson_create_bool(bool value);
 
 typedef struct 
 {
-    int value;
+    int64_t value;
 } cjson_integer;
 
 /**
- * @brief returns the integer value of element
+ * @brief returns the integer value of element truncated to an int
  */
 int cjson_as_integer(cjson_element *element);
+/**
+ * @brief returns the integer value of element
+ */
+int64_t cjson_as_int64(cjson_element *element);
 /**
  * @brief returns true if element is of integer type
  */
@@ -41,6 +53,34 @@ bool cjson_is_integer(cjson_element *element);
  * @brief create a cjson_element containing the given integer value
  */
 cjson_element *cjson_create_integer(int value);
+/**
+ * @brief create a cjson_element containing the given int64_t value, stored
+ *        without narrowing
+ */
+cjson_element *cjson_create_int64(int64_t value);
+
+/*
+ * Integers above INT64_MAX, smaller ones are always of integer type.
+ */
+typedef struct
+{
+    uint64_t value;
+} cjson_unsigned;
+
+/**
+ * @brief returns the value of an unsigned element or of a positive integer
+ *        element
+ */
+uint64_t cjson_as_uint64(cjson_element *element);
+/**
+ * @brief returns true if element is of unsigned type
+ */
+bool cjson_is_unsigned(cjson_element *element);
+/**
+ * @brief create a cjson_element containing the given value, of integer type
+ *        if it fits in one
+ */
+cjson_element *cjson_create_uint64(uint64_t value);
 
 typedef struct 
 {
@@ -100,17 +140,34 @@ void cjson_array_append(cjson_array *array, cjson_element *element);
  */
 void cjson_array_insert(cjson_array *array, cjson_element *element, size_t index);
 
-typedef struct cjson_map_item
+typedef struct
 {
     char *name;
     cjson_element *element;
-    struct cjson_map_item *next;
+    size_t hash;
 } cjson_map_item;
 
+/*
+ * Slot of the map index: position is the item index plus one, 0 for an empty
+ * slot, and hash holds the low bits of the item hash.
+ */
 typedef struct
 {
-    cjson_map_item **items;
-    size_t capacity;
+    uint32_t hash;
+    uint32_t position;
+} cjson_map_slot;
+
+/*
+ * Members are kept in insertion order in items. Maps that can hold up to
+ * CJSON_MAP_FLAT_MAX items are searched with a linear scan, bigger ones also
+ * get an open addressing index with Robin Hood probing.
+ */
+typedef struct
+{
+    cjson_map_item *items;
+    cjson_map_slot *index;
+    uint32_t size;
+    uint32_t capacity;
 } cjson_map;
 
 /**
@@ -140,8 +197,8 @@ cjson_object *cjson_as_object(cjson_element *element);
  */
 bool cjson_is_object(cjson_element *element);
 /**
- * @brief create a cjson_element with a map of size capacity (the bigger the
- *        size, the less chance of hash collosion)
+ * @brief create a cjson_element that is an empty object with room for
+ *        capacity members before it needs to grow
  */
 cjson_element *cjson_create_object(size_t capacity);
 
@@ -167,6 +224,123 @@ cjson_element *cjson_create_null();
  */
 cjson_element *cjson_get_element_from(cjson_element *element, char *from);
 
+/*
+ * Compiled paths: a path in the syntax of cjson_get_element_from read once,
+ * its member names hashed and its indices parsed, to be looked up in many
+ * elements.
+ */
+typedef struct cjson_path cjson_path;
+
+/**
+ * @brief compiles a path in the syntax of cjson_get_element_from, returns NULL
+ *        if it is malformed
+ */
+cjson_path *cjson_path_compile(const char *path);
+/**
+ * @brief returns the element path leads to from element, NULL if a member or
+ *        an index it goes through is missing. allocates nothing
+ */
+cjson_element *cjson_path_eval(const cjson_path *path, cjson_element *element);
+/**
+ * @brief deletes a compiled path
+ */
+void cjson_path_delete(cjson_path *path);
+
+/*
+ * Path sets: compiled paths merged into a prefix tree, looked up together so
+ * the prefixes they share are only followed once.
+ */
+typedef struct cjson_path_set cjson_path_set;
+
+/**
+ * @brief merges the n compiled paths into a set, the paths can be deleted
+ *        afterwards
+ */
+cjson_path_set *cjson_path_set_new(cjson_path **paths, size_t n);
+/**
+ * @brief looks every path of the set up from element in one walk, setting
+ *        out[i] to what the i-th path leads to or to NULL, like
+ *        cjson_path_eval. allocates nothing
+ */
+void cjson_path_set_eval(const cjson_path_set *set, cjson_element *element,
+        cjson_element **out);
+/**
+ * @brief deletes a path set
+ */
+void cjson_path_set_delete(cjson_path_set *set);
+
+/*
+ * JSONPath queries: "$" followed by selectors, each one applied to every
+ * element the ones before it selected.
+ *
+ *   .name ['name']    the member name
+ *   [i]               the i-th element of an array, counted from the end if
+ *                     i is negative
+ *   .* [*]            every member of an object or element of an array
+ *   [start:end:step]  an array slice, like in Python
+ *   ..name ..* ..[s]  the selector applied to the element and to all of its
+ *                     descendants
+ *   [?(@.a[0] > 3)]   the members or elements for which the comparison holds,
+ *                     with @ followed by a path in the syntax of
+ *                     cjson_get_element_from, one of == != < <= > >=, and a
+ *                     number, a quoted string, true, false or null.
+ *                     [?(@.a[0])] keeps those where the path exists
+ *
+ * Queries are compiled to a list of instructions and run by an iterator
+ * giving the results one at a time, which only keeps a position per selector.
+ */
+typedef struct cjson_query cjson_query;
+typedef struct cjson_query_iterator cjson_query_iterator;
+
+/**
+ * @brief compiles a JSONPath expression, returns NULL if it is malformed
+ */
+cjson_query *cjson_query_compile(const char *expression);
+/**
+ * @brief creates an iterator over the results of query from element. the
+ *        query must outlive it
+ */
+cjson_query_iterator *cjson_query_run(const cjson_query *query, cjson_element *element);
+/**
+ * @brief restarts an iterator from another element, reusing its memory
+ */
+void cjson_query_rewind(cjson_query_iterator *iterator, cjson_element *element);
+/**
+ * @brief returns the next result of the query, NULL once there is none left.
+ *        results come in document order for every selector but .., which
+ *        gives an element before its descendants
+ */
+cjson_element *cjson_query_next(cjson_query_iterator *iterator);
+/**
+ * @brief deletes a query iterator
+ */
+void cjson_query_iterator_delete(cjson_query_iterator *iterator);
+/**
+ * @brief deletes a compiled query
+ */
+void cjson_query_delete(cjson_query *query);
+
+/**
+ * @brief callback of cjson_query_stream, returning false to stop it
+ */
+typedef bool (*cjson_query_callback)(void *ctx, cjson_element *result);
+
+/**
+ * @brief runs query over the len bytes of buf without building the document,
+ *        giving each result to callback. returns -1 if the input is invalid
+ *        or callback stopped, 0 otherwise
+ *
+ * Values the query does not reach are skipped without being parsed, nor
+ * validated. Results are built one at a time and only valid during the call,
+ * and so are the values a filter tests and the arrays an index from the end
+ * counts in, whose results come as cjson_query_next gives them: memory is
+ * bounded by the nesting depth and the size of these values. Other results
+ * come in document order, once even if the query reaches them in several
+ * ways.
+ */
+int cjson_query_stream(const cjson_query *query, const char *buf, size_t len,
+        cjson_query_callback callback, void *ctx);
+
 typedef struct
 {
     char *name;
@@ -175,7 +349,6 @@ typedef struct
 #ifdef CJSON_IMPLEMENTATION
     cjson_map *map;
     size_t i;
-    cjson_map_item *item;
 #endif /* CJSON_IMPLEMENTATION */
 } cjson_object_iterator;
 
@@ -201,6 +374,7 @@ typedef union
 {
     cjson_bool boolean;
     cjson_integer integer;
+    cjson_unsigned unsigned_integer;
     cjson_float fraction;
     cjson_string string;
     cjson_array array;
@@ -214,6 +388,7 @@ struct cjson_element
         CJSON_NULL,
         CJSON_BOOL,
         CJSON_INTEGER,
+        CJSON_UNSIGNED,
         CJSON_FLOAT,
         CJSON_STRING,
         CJSON_ARRAY,
@@ -237,11 +412,26 @@ void cjson_str_builder_append_char(cjson_str_builder *sb, char c);
  * @brief appends a string to a string builder
  */
 void cjson_str_builder_append_cstr(cjson_str_builder *sb, char *cstr);
+/**
+ * @brief appends the len bytes of str to a string builder
+ */
+void cjson_str_builder_append(cjson_str_builder *sb, const char *str, size_t len);
 
 /**
  * @brief creates the string corresponding to the given element
  */
 char *cjson_to_str(cjson_element *element, int pretty);
+/**
+ * @brief returns the length of the string cjson_to_str would create, without
+ *        its NUL terminator
+ */
+size_t cjson_serialized_size(cjson_element *element, int pretty);
+/**
+ * @brief writes the string corresponding to the given element to buffer,
+ *        NUL-terminated and truncated to capacity bytes. returns the length
+ *        of the whole string, which did not fit if it is not below capacity
+ */
+size_t cjson_to_buffer(cjson_element *element, char *buffer, size_t capacity, int pretty);
 /**
  * @brief returns a deep copy of the element
  */
@@ -250,6 +440,17 @@ cjson_element *cjson_clone(cjson_element *element);
  * @brief prints the element to stdout
  */
 void cjson_dump(cjson_element *element, int pretty);
+/**
+ * @brief writes the string corresponding to the element to a file descriptor
+ *        through a fixed size buffer. returns -1 if a write failed, 0 otherwise
+ */
+int cjson_write_fd(cjson_element *element, int fd, int pretty);
+/**
+ * @brief writes the string corresponding to the element to a stream, directly
+ *        to its file descriptor when it has one. returns -1 if a write failed,
+ *        0 otherwise
+ */
+int cjson_write_file(cjson_element *element, FILE *file, int pretty);
 
 /**
  * @brief deletes a json element recursively
@@ -261,15 +462,224 @@ void cjson_delete(cjson_element *element);
  */
 cjson_element *cjson_parse_str(char *str);
 
-#ifdef CJSON_IMPLEMENTATION
+typedef struct
+{
+    // number of bytes past the end of the input that may be read, whatever
+    // their value, which lets the parser skip copying the last block
+    size_t padding;
+    // number of arrays and objects that may be nested before the parse fails,
+    // 0 for CJSON_DEFAULT_MAX_DEPTH
+    size_t max_depth;
+    // fail on strings and keys that are not valid UTF-8
+    bool validate_utf8;
+} cjson_parse_options;
 
-#define _POSIX_C_SOURCE 200809L
+/**
+ * @brief parses the len bytes of buf, which need not be NUL-terminated, to
+ *        create a json element. options may be NULL. return NULL if it fails
+ */
+cjson_element *cjson_parse_n(const char *buf, size_t len,
+        const cjson_parse_options *options);
+
+typedef struct cjson_document cjson_document;
+
+/**
+ * @brief parses a string into a document that allocates all of its elements,
+ *        keys and strings from a few large chunks. return NULL if it fails
+ *
+ * Elements of a document belong to it: they must not be deleted or grown on
+ * their own, use cjson_clone to get an independent copy.
+ */
+cjson_document *cjson_parse_document(char *str);
+/**
+ * @brief parses the len bytes of buf into a document whose strings and keys
+ *        point inside buf. return NULL if it fails
+ *
+ * Strings are decoded and NUL-terminated in place, which overwrites buf: it
+ * must outlive the document and not be modified while the document is used.
+ */
+cjson_document *cjson_parse_insitu(char *buf, size_t len);
+/**
+ * @brief returns the root element of a document
+ */
+cjson_element *cjson_document_root(cjson_document *document);
+/**
+ * @brief creates a document holding a deep copy of the element
+ */
+cjson_document *cjson_clone_document(cjson_element *element);
+/**
+ * @brief deletes a document and all of its elements at once
+ */
+void cjson_document_delete(cjson_document *document);
+
+typedef struct cjson_parser cjson_parser;
+
+/**
+ * @brief creates a parser the input is fed to chunk by chunk. options may be
+ *        NULL, their padding is ignored
+ *
+ * Chunks may be cut anywhere, even inside a string, a number or an escape.
+ * Each chunk is parsed as soon as it is fed, only the start of a token cut by
+ * its end is kept until the next one.
+ */
+cjson_parser *cjson_parser_new(const cjson_parse_options *options);
+/**
+ * @brief parses the len bytes of chunk, which may be reused as soon as this
+ *        returns. returns -1 if the input is already known to be invalid, 0
+ *        otherwise
+ */
+int cjson_parser_feed(cjson_parser *parser, const char *chunk, size_t len);
+/**
+ * @brief ends the input and deletes the parser. returns the element parsed,
+ *        NULL if the input was not exactly one json value
+ */
+cjson_element *cjson_parser_finish(cjson_parser *parser);
+/**
+ * @brief deletes a parser and what it parsed so far, to give up on an input
+ */
+void cjson_parser_delete(cjson_parser *parser);
+
+/*
+ * Parse events, for inputs that are only scanned to count, route or pick a few
+ * fields: values are given to callbacks as they are read and no element is
+ * allocated. Each callback gets the ctx given to the parse and returns false
+ * to stop it. A NULL callback ignores its events.
+ */
+typedef struct
+{
+    bool (*null)(void *ctx);
+    bool (*boolean)(void *ctx, bool value);
+    bool (*integer)(void *ctx, int64_t value);
+    bool (*unsigned_integer)(void *ctx, uint64_t value);
+    bool (*fraction)(void *ctx, double value);
+    // str holds the len decoded bytes of the string, it is not NUL-terminated
+    // and only valid during the call
+    bool (*string)(void *ctx, const char *str, size_t len);
+    bool (*start_object)(void *ctx);
+    // name of the member whose value comes next, given as a string
+    bool (*key)(void *ctx, const char *str, size_t len);
+    bool (*end_object)(void *ctx);
+    bool (*start_array)(void *ctx);
+    bool (*end_array)(void *ctx);
+} cjson_handler;
+
+/**
+ * @brief parses the len bytes of buf, giving its values to the callbacks of
+ *        handler in document order. options may be NULL. returns -1 if the
+ *        input is invalid or a callback stopped the parse, 0 otherwise
+ *
+ * The events of an invalid input are given up to where it fails.
+ */
+int cjson_parse_events(const char *buf, size_t len, const cjson_handler *handler,
+        void *ctx, const cjson_parse_options *options);
+
+/*
+ * Pull reader: the caller asks for the events of a document one at a time,
+ * skips the values it does not need and decodes only those it wants.
+ */
+typedef struct cjson_reader cjson_reader;
+
+// What cjson_reader_next read
+enum
+{
+    CJSON_READ_ERROR = -1,
+    // the document is complete
+    CJSON_READ_END,
+    CJSON_READ_NULL,
+    CJSON_READ_BOOL,
+    CJSON_READ_INTEGER,
+    CJSON_READ_UNSIGNED,
+    CJSON_READ_FLOAT,
+    CJSON_READ_STRING,
+    CJSON_READ_KEY,
+    CJSON_READ_START_OBJECT,
+    CJSON_READ_END_OBJECT,
+    CJSON_READ_START_ARRAY,
+    CJSON_READ_END_ARRAY,
+};
+
+/**
+ * @brief creates a reader over the len bytes of buf, which must outlive it.
+ *        options may be NULL
+ */
+cjson_reader *cjson_reader_new(const char *buf, size_t len,
+        const cjson_parse_options *options);
+/**
+ * @brief reads the next event of the document and returns its type. once the
+ *        document is complete or invalid, returns CJSON_READ_END or
+ *        CJSON_READ_ERROR again on every call
+ */
+int cjson_reader_next(cjson_reader *reader);
+/**
+ * @brief skips the value the last event started: the value of the member
+ *        after CJSON_READ_KEY, the rest of the container after
+ *        CJSON_READ_START_OBJECT or CJSON_READ_START_ARRAY, nothing after a
+ *        scalar. returns -1 if the input is invalid, 0 otherwise
+ *
+ * The reader is then on the end of the skipped value. A skipped container is
+ * passed over at memory speed: only its end is looked for, what it holds is
+ * not validated.
+ */
+int cjson_reader_skip_value(cjson_reader *reader);
+/**
+ * @brief returns the value read by a CJSON_READ_BOOL event
+ */
+bool cjson_reader_get_bool(cjson_reader *reader);
+/**
+ * @brief returns the value read by a CJSON_READ_INTEGER event
+ */
+int64_t cjson_reader_get_int64(cjson_reader *reader);
+/**
+ * @brief returns the value read by a CJSON_READ_UNSIGNED event or a positive
+ *        one read by a CJSON_READ_INTEGER event
+ */
+uint64_t cjson_reader_get_uint64(cjson_reader *reader);
+/**
+ * @brief returns the value read by any number event, converted to a double
+ */
+double cjson_reader_get_double(cjson_reader *reader);
+/**
+ * @brief returns the string read by a CJSON_READ_STRING or CJSON_READ_KEY
+ *        event and sets len to its length. it is not NUL-terminated and only
+ *        valid until the next call on the reader
+ */
+const char *cjson_reader_get_string(cjson_reader *reader, size_t *len);
+/**
+ * @brief deletes a reader, not its input
+ */
+void cjson_reader_delete(cjson_reader *reader);
+
+/**
+ * @brief parses only what the n paths reach in the len bytes of buf, paths in
+ *        the syntax of cjson_get_element_from, "" selecting the whole
+ *        document. returns NULL if the input or a path is invalid
+ *
+ * The root and the containers leading to a selected value are kept, holding
+ * nothing else: arrays get null elements in place of the ones before a
+ * selected index, so every path finds its value in the result with
+ * cjson_get_element_from. Paths leading nowhere are left out. Containers off
+ * every path are skipped without being parsed, like with
+ * cjson_reader_skip_value.
+ */
+cjson_element *cjson_parse_select(const char *buf, size_t len, char **paths, size_t n);
+
+#ifdef CJSON_IMPLEMENTATION
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if !defined(CJSON_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define CJSON_X86
+#include <immintrin.h>
+#endif /* !CJSON_NO_SIMD && x86 */
 
 #define TODO() assert(0 && "TODO")
 
@@ -295,174 +705,2536 @@ void cjson_str_builder_append_cstr(cjson_str_builder *sb, char *cstr)
         cjson_str_builder_append_char(sb, cstr[i]);
 }
 
-size_t cjson_hash(char *str)
+void cjson_str_builder_append(cjson_str_builder *sb, const char *str, size_t len)
 {
-    size_t res = 0;
-    for (size_t i = 0; str[i] != '\0'; i++)
-        res = (res << 3) + str[i];
-    return res;
+    if (len == 0)
+        return;
+    if (sb->size + len > sb->capacity)
+    {
+        sb->capacity = sb->capacity == 0 ? 8 : sb->capacity;
+        while (sb->size + len > sb->capacity)
+            sb->capacity *= 2;
+        sb->str = realloc(sb->str, sb->capacity * sizeof(char));
+    }
+    memcpy(sb->str + sb->size, str, len);
+    sb->size += len;
 }
 
-void cjson_map_insert(cjson_map *map, char *name, cjson_element *element)
+/*
+ * Bump allocator backing documents: allocations are carved out of chunks that
+ * are only released all together when the document is deleted.
+ */
+
+#ifndef CJSON_ARENA_CHUNK_SIZE
+#define CJSON_ARENA_CHUNK_SIZE 4096
+#endif /* ! CJSON_ARENA_CHUNK_SIZE */
+
+#ifndef CJSON_ARENA_MAX_CHUNK_SIZE
+#define CJSON_ARENA_MAX_CHUNK_SIZE (1 << 20)
+#endif /* ! CJSON_ARENA_MAX_CHUNK_SIZE */
+
+typedef struct cjson_arena_chunk
 {
-    size_t h = cjson_hash(name) % map->capacity;
-    cjson_map_item *item = map->items[h];
-    while (item != NULL && strcmp(item->name, name) != 0)
-        item = item->next;
-    if (item == NULL)
+    struct cjson_arena_chunk *next;
+} cjson_arena_chunk;
+
+typedef struct
+{
+    cjson_arena_chunk *chunks;
+    char *cursor;
+    char *end;
+    size_t chunk_size;
+} cjson_arena;
+
+struct cjson_document
+{
+    cjson_element *root;
+    cjson_arena arena;
+};
+
+static void *cjson_arena_alloc(cjson_arena *arena, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if ((size_t)(arena->end - arena->cursor) < size)
     {
-        cjson_map_item *item = malloc(sizeof(cjson_map_item));
-        item->next = map->items[h];
-        item->name = strdup(name);
-        item->element = element;
-        map->items[h] = item;
+        if (arena->chunk_size == 0)
+            arena->chunk_size = CJSON_ARENA_CHUNK_SIZE;
+        if (size > arena->chunk_size / 4)
+        {
+            // Big allocations get their own chunk, the current one is kept
+            cjson_arena_chunk *chunk = malloc(sizeof(cjson_arena_chunk) + size);
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+            return chunk + 1;
+        }
+        cjson_arena_chunk *chunk = malloc(sizeof(cjson_arena_chunk) + arena->chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->cursor = (char *)(chunk + 1);
+        arena->end = arena->cursor + arena->chunk_size;
+        if (arena->chunk_size < CJSON_ARENA_MAX_CHUNK_SIZE)
+            arena->chunk_size *= 2;
     }
-    else
+    void *res = arena->cursor;
+    arena->cursor += size;
+    return res;
+}
+
+static void cjson_arena_release(cjson_arena *arena)
+{
+    while (arena->chunks != NULL)
     {
-        cjson_delete(item->element);
-        item->element = element;
+        cjson_arena_chunk *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
     }
+    arena->cursor = NULL;
+    arena->end = NULL;
 }
 
-enum
+/**
+ * @brief allocates zeroed memory from the arena, or from the heap if arena is
+ *        NULL
+ */
+static void *cjson_alloc(cjson_arena *arena, size_t size)
 {
-    CJSON_TOK_ERROR = -1,
-    CJSON_TOK_NONE = 0,
-    CJSON_TOK_EOF,
-    CJSON_TOK_INTEGER,
-    CJSON_TOK_FLOAT,
-    CJSON_TOK_STRING,
-    CJSON_TOK_TRUE,
-    CJSON_TOK_FALSE,
-    CJSON_TOK_NULL,
-    CJSON_TOK_COLON,
-    CJSON_TOK_COMMA,
-    CJSON_TOK_LBRACE,
-    CJSON_TOK_RBRACE,
-    CJSON_TOK_LBRACK,
-    CJSON_TOK_RBRACK,
-};
+    if (arena == NULL)
+        return calloc(1, size);
+    void *res = cjson_arena_alloc(arena, size);
+    memset(res, 0, size);
+    return res;
+}
 
-typedef struct
+static void cjson_free(cjson_arena *arena, void *ptr)
 {
-    int type;
-    char *content;
-    size_t content_len;
-    int integer_value;
-    double float_value;
-} cjson_token;
+    if (arena == NULL)
+        free(ptr);
+}
 
-int cjson_hex_to_int(char c)
+static char *cjson_strndup(cjson_arena *arena, const char *str, size_t len)
 {
-    return isalpha(c) ? tolower(c) - 'a' + 10 : c - '0';
+    // Not cjson_alloc, every byte gets written
+    char *res = arena == NULL ? malloc(len + 1) : cjson_arena_alloc(arena, len + 1);
+    memcpy(res, str, len);
+    res[len] = '\0';
+    return res;
 }
 
-static char *cjson_extract_string(cjson_token *token)
+static cjson_element *cjson_new_element(cjson_arena *arena, int element_type)
 {
-    assert(token->type == CJSON_STRING);
-    unsigned char *res = calloc(token->content_len - 1, sizeof(char));
-    size_t j = 0;
-    for (size_t i = 1; i < token->content_len - 1; i++)
-    {
-        if (token->content[i] == '\\')
-        {
-            i += 1;
-            switch (token->content[i])
-            {
-            case '"':
-                res[j] = '"';
-                break;
-            case '\\':
-                res[j] = '\\';
-                break;
-            case '/':
-                res[j] = '/';
-                break;
-            case 'b':
-                res[j] = '\b';
-                break;
-            case 'f':
-                res[j] = '\f';
-                break;
-            case 'n':
-                res[j] = '\n';
-                break;
-            case 't':
-                res[j] = '\t';
-                break;
-            case 'u':
-                i += 1;
-                res[j] = cjson_hex_to_int(token->content[i]) * 16
-                            + cjson_hex_to_int(token->content[i + 1]);
-                if (res[j] != 0)
-                    j += 1;
-                i += 2;
-                res[j] = cjson_hex_to_int(token->content[i]) * 16
-                            + cjson_hex_to_int(token->content[i + 1]);
-                i += 1;
-                break;
-            default:
-                free(res);
-                return NULL;
-            }
-        }
-        else
-            res[j] = token->content[i];
-        j += 1;
-    }
+    cjson_element *res = cjson_alloc(arena, sizeof(cjson_element));
+    res->element_type = element_type;
     return res;
 }
 
-typedef struct
+/*
+ * String hashing, after wyhash: the input is read 4, 8 or 16 bytes at a time
+ * and folded with 64x64->128 bits multiplications, so every byte of long keys
+ * with common prefixes affects the low bits used to pick a slot.
+ */
+
+static const uint64_t cjson_hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+
+static inline void cjson_mum(uint64_t *a, uint64_t *b)
 {
-    char *content;
-    size_t location;
-    cjson_token token;
-} cjson_lexer;
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif /* __SIZEOF_INT128__ */
+}
 
-void cjson_read_next_token(cjson_lexer *lexer)
+static inline uint64_t cjson_mix(uint64_t a, uint64_t b)
 {
-    char *input = lexer->content + lexer->location;
-    size_t token_len = 0;
-    int sign = 1;
-    switch (input[0])
+    cjson_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t cjson_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t cjson_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief hashes the len first bytes of str
+ */
+size_t cjson_hash(const char *str, size_t len)
+{
+    const uint64_t *secret = cjson_hash_secret;
+    const unsigned char *p = (const unsigned char *)str;
+    uint64_t seed = cjson_mix(secret[0], secret[1]);
+    uint64_t a;
+    uint64_t b;
+    if (len <= 16)
     {
-    case '-':
-        sign = -1;
-        /* FALLTHROUGH */
-    case '0'...'9':
-        lexer->token.type = CJSON_TOK_INTEGER;
-        token_len = 1;
-        if (input[0] != '0')
+        if (len >= 4)
         {
-            while (isdigit(input[token_len]))
-                token_len += 1;
+            size_t mid = (len >> 3) << 2;
+            a = (cjson_read32(p) << 32) | cjson_read32(p + mid);
+            b = (cjson_read32(p + len - 4) << 32) | cjson_read32(p + len - 4 - mid);
         }
-        lexer->token.integer_value = strtol(input, NULL, 10) * sign;
-        if (input[token_len] == '.' && isdigit(input[token_len + 1]))
+        else if (len > 0)
         {
-            lexer->token.type = CJSON_TOK_FLOAT;
-            token_len += 1;
-            while (isdigit(input[token_len + 1]))
-                token_len += 1;
-            lexer->token.float_value = strtod(input, NULL) * sign;
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
         }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do
+            {
+                seed = cjson_mix(cjson_read64(p) ^ secret[1], cjson_read64(p + 8) ^ seed);
+                see1 = cjson_mix(cjson_read64(p + 16) ^ secret[2], cjson_read64(p + 24) ^ see1);
+                see2 = cjson_mix(cjson_read64(p + 32) ^ secret[3], cjson_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = cjson_mix(cjson_read64(p) ^ secret[1], cjson_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = cjson_read64(p + i - 16);
+        b = cjson_read64(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    cjson_mum(&a, &b);
+    return cjson_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+#ifndef CJSON_MAP_MIN_CAPACITY
+#define CJSON_MAP_MIN_CAPACITY 4
+#endif /* ! CJSON_MAP_MIN_CAPACITY */
+
+#ifndef CJSON_MAP_FLAT_MAX
+#define CJSON_MAP_FLAT_MAX 8
+#endif /* ! CJSON_MAP_FLAT_MAX */
+
+/**
+ * @brief size of the index of a map holding capacity items, a power of two
+ *        keeping the load factor under 3/4
+ */
+static size_t cjson_map_index_capacity(size_t capacity)
+{
+    size_t res = CJSON_MAP_MIN_CAPACITY;
+    while (capacity * 4 > res * 3)
+        res *= 2;
+    return res;
+}
+
+/**
+ * @brief puts a slot that is not in the index yet in an index that has room
+ *        for it, moving richer slots further away
+ */
+static void cjson_map_place(cjson_map_slot *index, size_t capacity, cjson_map_slot item)
+{
+    size_t mask = capacity - 1;
+    size_t slot = item.hash & mask;
+    for (size_t dist = 0; index[slot].position != 0; dist++)
+    {
+        size_t other_dist = (slot - index[slot].hash) & mask;
+        if (other_dist < dist)
+        {
+            cjson_map_slot tmp = index[slot];
+            index[slot] = item;
+            item = tmp;
+            dist = other_dist;
+        }
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = item;
+}
+
+/**
+ * @brief grows the map so it can hold exactly capacity items, indexing them
+ *        when they do not fit in a flat map anymore
+ */
+static void cjson_map_reserve(cjson_map *map, cjson_arena *arena, size_t capacity)
+{
+    if (capacity <= map->capacity)
+        return;
+    assert(capacity <= UINT32_MAX);
+    cjson_map_item *items = cjson_alloc(arena, capacity * sizeof(cjson_map_item));
+    if (map->size > 0)
+        memcpy(items, map->items, map->size * sizeof(cjson_map_item));
+    cjson_free(arena, map->items);
+    map->items = items;
+    map->capacity = capacity;
+
+    cjson_free(arena, map->index);
+    map->index = NULL;
+    if (capacity <= CJSON_MAP_FLAT_MAX)
+        return;
+    size_t index_capacity = cjson_map_index_capacity(capacity);
+    map->index = cjson_alloc(arena, index_capacity * sizeof(cjson_map_slot));
+    for (size_t i = 0; i < map->size; i++)
+    {
+        cjson_map_slot slot = { .hash = items[i].hash, .position = i + 1 };
+        cjson_map_place(map->index, index_capacity, slot);
+    }
+}
+
+static cjson_map_item *cjson_map_find(cjson_map *map, char *name, size_t hash)
+{
+    if (map->index == NULL)
+    {
+        for (size_t i = 0; i < map->size; i++)
+        {
+            cjson_map_item *item = &map->items[i];
+            if (item->hash == hash && strcmp(item->name, name) == 0)
+                return item;
+        }
+        return NULL;
+    }
+    size_t mask = cjson_map_index_capacity(map->capacity) - 1;
+    size_t slot = hash & mask;
+    for (size_t dist = 0; map->index[slot].position != 0; dist++)
+    {
+        cjson_map_slot *current = &map->index[slot];
+        // Past this point the name would have taken the slot
+        if (((slot - current->hash) & mask) < dist)
+            return NULL;
+        if (current->hash == (uint32_t)hash)
+        {
+            cjson_map_item *item = &map->items[current->position - 1];
+            if (item->hash == hash && strcmp(item->name, name) == 0)
+                return item;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/**
+ * @brief appends an item that is not in the map yet to a map that has room
+ *        for it
+ */
+static void cjson_map_append(cjson_map *map, cjson_map_item item)
+{
+    assert(map->size < map->capacity);
+    map->items[map->size] = item;
+    map->size += 1;
+    if (map->index != NULL)
+    {
+        cjson_map_slot slot = { .hash = item.hash, .position = map->size };
+        cjson_map_place(map->index, cjson_map_index_capacity(map->capacity), slot);
+    }
+}
+
+/**
+ * @brief adds a member that is not in the map yet, taking ownership of name
+ */
+static void cjson_map_add(cjson_map *map, cjson_arena *arena, char *name,
+        size_t hash, cjson_element *element)
+{
+    if (map->size == map->capacity)
+    {
+        size_t capacity = map->capacity * 2;
+        cjson_map_reserve(map, arena, capacity < CJSON_MAP_MIN_CAPACITY
+                ? CJSON_MAP_MIN_CAPACITY : capacity);
+    }
+    cjson_map_item item = { .name = name, .element = element, .hash = hash };
+    cjson_map_append(map, item);
+}
+
+void cjson_map_insert(cjson_map *map, char *name, cjson_element *element)
+{
+    size_t hash = cjson_hash(name, strlen(name));
+    cjson_map_item *item = cjson_map_find(map, name, hash);
+    if (item == NULL)
+        cjson_map_add(map, NULL, cjson_strndup(NULL, name, strlen(name)), hash, element);
+    else
+    {
+        cjson_delete(item->element);
+        item->element = element;
+    }
+}
+
+enum
+{
+    CJSON_TOK_ERROR = -1,
+    CJSON_TOK_NONE = 0,
+    CJSON_TOK_EOF,
+    // cut by the end of partial content, see cjson_lexer.partial
+    CJSON_TOK_PARTIAL,
+    CJSON_TOK_INTEGER,
+    CJSON_TOK_UNSIGNED,
+    CJSON_TOK_FLOAT,
+    CJSON_TOK_STRING,
+    CJSON_TOK_TRUE,
+    CJSON_TOK_FALSE,
+    CJSON_TOK_NULL,
+    CJSON_TOK_COLON,
+    CJSON_TOK_COMMA,
+    CJSON_TOK_LBRACE,
+    CJSON_TOK_RBRACE,
+    CJSON_TOK_LBRACK,
+    CJSON_TOK_RBRACK,
+};
+
+typedef struct
+{
+    int type;
+    char *content;
+    size_t content_len;
+    int64_t integer_value;
+    uint64_t unsigned_value;
+    double float_value;
+} cjson_token;
+
+/*
+ * Stage 1: structural indexing.
+ *
+ * The input is classified 64 bytes at a time into bitmasks (quotes,
+ * backslashes, whitespace and operators) using the widest instruction set
+ * available at runtime. The masks are then combined to find which bytes are
+ * inside strings and the positions of every structural character: operators
+ * outside of strings, quotes and the first byte of every other token. The
+ * lexer walks these positions instead of scanning whitespace and string
+ * contents one byte at a time.
+ *
+ * Indexing is done by windows of CJSON_STAGE1_WINDOW bytes so the index stays
+ * small, lives inside the lexer and is hot in cache whatever the size of the
+ * document.
+ */
+
+// must be a multiple of 64
+#ifndef CJSON_STAGE1_WINDOW
+#define CJSON_STAGE1_WINDOW 2048
+#endif /* ! CJSON_STAGE1_WINDOW */
+
+typedef struct
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t space;
+    uint64_t op;
+} cjson_block;
+
+typedef struct
+{
+    uint64_t prev_escaped;
+    uint64_t prev_in_string;
+    uint64_t prev_scalar;
+} cjson_stage1_state;
+
+typedef void (*cjson_classify_fn)(const unsigned char *input, cjson_block *block);
+
+static void cjson_classify_scalar(const unsigned char *input, cjson_block *block)
+{
+    memset(block, 0, sizeof(cjson_block));
+    for (int i = 0; i < 64; i++)
+    {
+        uint64_t bit = 1ULL << i;
+        switch (input[i])
+        {
+        case '"':
+            block->quote |= bit;
+            break;
+        case '\\':
+            block->backslash |= bit;
+            break;
+        case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+            block->space |= bit;
+            break;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+            block->op |= bit;
+            break;
+        }
+    }
+}
+
+#ifdef CJSON_X86
+
+#define CJSON_SIDD_ANY (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK)
+
+__attribute__((target("sse4.2")))
+static void cjson_classify_sse42(const unsigned char *input, cjson_block *block)
+{
+    const __m128i ops = _mm_setr_epi8('{', '}', '[', ']', ':', ',',
+                                      0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i spaces = _mm_setr_epi8(' ', '\t', '\n', '\v', '\f', '\r',
+                                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    memset(block, 0, sizeof(cjson_block));
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+        uint64_t quote = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(in, _mm_set1_epi8('"')));
+        uint64_t backslash = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(in, _mm_set1_epi8('\\')));
+        uint64_t op = (uint16_t)_mm_cvtsi128_si32(
+                _mm_cmpestrm(ops, 6, in, 16, CJSON_SIDD_ANY));
+        uint64_t space = (uint16_t)_mm_cvtsi128_si32(
+                _mm_cmpestrm(spaces, 6, in, 16, CJSON_SIDD_ANY));
+        block->quote |= quote << (16 * i);
+        block->backslash |= backslash << (16 * i);
+        block->op |= op << (16 * i);
+        block->space |= space << (16 * i);
+    }
+}
+
+__attribute__((target("avx2")))
+static void cjson_classify_avx2(const unsigned char *input, cjson_block *block)
+{
+    memset(block, 0, sizeof(cjson_block));
+    for (int i = 0; i < 2; i++)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(input + 32 * i));
+        // '{' and '[' only differ by the 0x20 bit, so do '}' and ']'
+        __m256i folded = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+        __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                                _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(':')),
+                                _mm256_cmpeq_epi8(in, _mm256_set1_epi8(','))));
+        // '\t' to '\r' are contiguous: c - '\t' <= 4 as unsigned bytes
+        __m256i shifted = _mm256_sub_epi8(in, _mm256_set1_epi8('\t'));
+        __m256i space = _mm256_or_si256(
+                _mm256_cmpeq_epi8(in, _mm256_set1_epi8(' ')),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)),
+                                  shifted));
+        uint64_t quote = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')));
+        uint64_t backslash = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\')));
+        block->quote |= quote << (32 * i);
+        block->backslash |= backslash << (32 * i);
+        block->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (32 * i);
+        block->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << (32 * i);
+    }
+}
+
+#endif /* CJSON_X86 */
+
+enum
+{
+    CJSON_SIMD_NONE,
+    CJSON_SIMD_SSE42,
+    CJSON_SIMD_AVX2,
+};
+
+/**
+ * @brief returns the best instruction set supported by the running CPU
+ */
+static int cjson_simd_level(void)
+{
+    // Threads racing on the first call all detect and store the same level
+    static int cached = -1;
+    int level = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (level < 0)
+    {
+#ifdef CJSON_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = CJSON_SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse4.2"))
+            level = CJSON_SIMD_SSE42;
+        else
+#endif /* CJSON_X86 */
+            level = CJSON_SIMD_NONE;
+        __atomic_store_n(&cached, level, __ATOMIC_RELAXED);
+    }
+    return level;
+}
+
+static cjson_classify_fn cjson_classifier(void)
+{
+    switch (cjson_simd_level())
+    {
+#ifdef CJSON_X86
+    case CJSON_SIMD_AVX2:
+        return cjson_classify_avx2;
+    case CJSON_SIMD_SSE42:
+        return cjson_classify_sse42;
+#endif /* CJSON_X86 */
+    default:
+        return cjson_classify_scalar;
+    }
+}
+
+static inline uint64_t cjson_prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/**
+ * @brief returns the bytes of a block inside strings, opening quotes and
+ *        contents but not closing quotes, and sets quote to the quotes that
+ *        are not escaped
+ */
+static inline uint64_t cjson_stage1_strings(cjson_stage1_state *state,
+        uint64_t backslash, uint64_t *quote)
+{
+    // A backslash escapes the next byte unless it is itself escaped, so a run
+    // of backslashes escapes the byte after it when its length is odd. The
+    // subtraction carries through every run at once and leaves, on the byte
+    // after it, a bit telling the parity of its length.
+    const uint64_t odd_bits = 0xaaaaaaaaaaaaaaaaULL;
+    uint64_t potential = backslash & ~state->prev_escaped;
+    uint64_t code = (((potential << 1) | odd_bits) - potential) ^ odd_bits;
+    uint64_t escaped = code ^ (backslash | state->prev_escaped);
+    state->prev_escaped = (code & backslash) >> 63;
+
+    *quote &= ~escaped;
+    uint64_t in_string = cjson_prefix_xor(*quote) ^ state->prev_in_string;
+    state->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    return in_string;
+}
+
+/**
+ * @brief turns the classification of a block into structural positions
+ *        written to out, returns the number of positions written
+ */
+static size_t cjson_stage1_block(cjson_stage1_state *state, cjson_block *block,
+        uint64_t valid, uint32_t base, uint32_t *out)
+{
+    uint64_t quote = block->quote;
+    uint64_t in_string = cjson_stage1_strings(state, block->backslash, &quote);
+
+    uint64_t scalar = ~(block->space | block->op | quote | in_string);
+    uint64_t scalar_start = scalar & ~((scalar << 1) | state->prev_scalar);
+    state->prev_scalar = scalar >> 63;
+
+    uint64_t structural = ((block->op & ~in_string) | quote | scalar_start) & valid;
+    size_t n = 0;
+    while (structural != 0)
+    {
+        out[n++] = base + __builtin_ctzll(structural);
+        structural &= structural - 1;
+    }
+    return n;
+}
+
+#ifndef CJSON_DEFAULT_MAX_DEPTH
+#define CJSON_DEFAULT_MAX_DEPTH 1024
+#endif /* ! CJSON_DEFAULT_MAX_DEPTH */
+
+// Token cjson_lexer_parse was waiting for when its content ran out
+enum
+{
+    CJSON_RESUME_VALUE,
+    CJSON_RESUME_OBJECT_START,
+    CJSON_RESUME_ARRAY_START,
+    CJSON_RESUME_NEXT,
+    CJSON_RESUME_KEY,
+    CJSON_RESUME_COLON,
+    // after a complete value, the next token is a separator or the end
+    CJSON_RESUME_VALUE_DONE,
+};
+
+typedef struct
+{
+    // only written to when parsing in situ
+    const char *content;
+    size_t location;
+    cjson_token token;
+    size_t size;
+    // readable bytes past the end of the content, whatever their value
+    size_t padding;
+    // strings and keys are decoded over the content instead of being copied
+    bool insitu;
+    bool validate_utf8;
+    // more input may follow the content: tokens reaching its end are
+    // CJSON_TOK_PARTIAL rather than complete or invalid, and cjson_lexer_parse
+    // stops on them to resume from resume once given the rest
+    bool partial;
+    int resume;
+    // strings with escapes are decoded there when not parsing in situ
+    char *scratch;
+    size_t scratch_capacity;
+    // containers being parsed from the outermost, true for objects
+    bool *nesting;
+    size_t depth;
+    size_t nesting_capacity;
+    size_t max_depth;
+    // structural index of the current window, unused when lexing byte by byte
+    bool indexing;
+    uint32_t structurals[CJSON_STAGE1_WINDOW + 64];
+    size_t structurals_base;
+    size_t structurals_size;
+    size_t structural;
+    size_t indexed;
+    cjson_stage1_state stage1;
+} cjson_lexer;
+
+/**
+ * @brief sets up a lexer over size bytes of content, reading its tokens from
+ *        the structural index if indexing is true
+ *
+ * The index window is left uninitialized, it is only read once filled.
+ */
+static void cjson_lexer_init(cjson_lexer *lexer, const char *content, size_t size,
+        bool indexing)
+{
+    lexer->content = content;
+    lexer->location = 0;
+    lexer->token.type = CJSON_TOK_NONE;
+    lexer->size = size;
+    lexer->padding = 0;
+    lexer->insitu = false;
+    lexer->validate_utf8 = false;
+    lexer->partial = false;
+    lexer->resume = CJSON_RESUME_VALUE;
+    lexer->scratch = NULL;
+    lexer->scratch_capacity = 0;
+    lexer->nesting = NULL;
+    lexer->depth = 0;
+    lexer->nesting_capacity = 0;
+    lexer->max_depth = CJSON_DEFAULT_MAX_DEPTH;
+    lexer->indexing = indexing;
+    lexer->structurals_base = 0;
+    lexer->structurals_size = 0;
+    lexer->structural = 0;
+    lexer->indexed = 0;
+    memset(&lexer->stage1, 0, sizeof(cjson_stage1_state));
+}
+
+/**
+ * @brief frees the buffers of a lexer, not its content
+ */
+static void cjson_lexer_release(cjson_lexer *lexer)
+{
+    free(lexer->scratch);
+    free(lexer->nesting);
+}
+
+static void cjson_lexer_index_window(cjson_lexer *lexer)
+{
+    cjson_classify_fn classify = cjson_classifier();
+    const unsigned char *input = (const unsigned char *)lexer->content;
+    size_t start = lexer->indexed;
+    size_t end = lexer->size - start < CJSON_STAGE1_WINDOW
+        ? lexer->size : start + CJSON_STAGE1_WINDOW;
+
+    lexer->structurals_base = start;
+    lexer->structurals_size = 0;
+    lexer->structural = 0;
+    for (size_t pos = start; pos < end; pos += 64)
+    {
+        cjson_block block;
+        uint64_t valid = ~0ULL;
+        if (end - pos >= 64)
+            classify(input + pos, &block);
+        else if (end == lexer->size && lexer->padding >= 64 - (end - pos))
+        {
+            // The bytes past the end are readable, only their bits are dropped
+            classify(input + pos, &block);
+            valid = (1ULL << (end - pos)) - 1;
+        }
+        else
+        {
+            unsigned char padded[64] = { 0 };
+            memcpy(padded, input + pos, end - pos);
+            classify(padded, &block);
+            valid = (1ULL << (end - pos)) - 1;
+        }
+        lexer->structurals_size += cjson_stage1_block(&lexer->stage1, &block,
+                valid, pos - start, lexer->structurals + lexer->structurals_size);
+    }
+    lexer->indexed = end;
+}
+
+/**
+ * @brief returns the location of the next structural character, or the size
+ *        of the input if there is none
+ */
+static size_t cjson_lexer_next_structural(cjson_lexer *lexer)
+{
+    while (lexer->structural == lexer->structurals_size)
+    {
+        if (lexer->indexed >= lexer->size)
+            return lexer->size;
+        cjson_lexer_index_window(lexer);
+    }
+    return lexer->structurals_base + lexer->structurals[lexer->structural++];
+}
+
+/*
+ * Skipping: values nobody asked for are passed over without being tokenized.
+ * What remains of the index window is walked for brackets only. The rest of
+ * the value is classified 64 bytes at a time into quotes, backslashes,
+ * opening and closing brackets, from which only the string mask is computed:
+ * blocks that cannot close the value are accounted for with two popcounts.
+ */
+
+typedef struct
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t open;
+    uint64_t close;
+} cjson_bracket_block;
+
+typedef void (*cjson_classify_brackets_fn)(const unsigned char *input,
+        cjson_bracket_block *block);
+
+static void cjson_classify_brackets_scalar(const unsigned char *input,
+        cjson_bracket_block *block)
+{
+    memset(block, 0, sizeof(cjson_bracket_block));
+    for (int i = 0; i < 64; i++)
+    {
+        uint64_t bit = 1ULL << i;
+        switch (input[i])
+        {
+        case '"':
+            block->quote |= bit;
+            break;
+        case '\\':
+            block->backslash |= bit;
+            break;
+        case '{': case '[':
+            block->open |= bit;
+            break;
+        case '}': case ']':
+            block->close |= bit;
+            break;
+        }
+    }
+}
+
+#ifdef CJSON_X86
+
+__attribute__((target("sse4.2")))
+static void cjson_classify_brackets_sse42(const unsigned char *input,
+        cjson_bracket_block *block)
+{
+    memset(block, 0, sizeof(cjson_bracket_block));
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+        __m128i folded = _mm_or_si128(in, _mm_set1_epi8(0x20));
+        uint64_t quote = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(in, _mm_set1_epi8('"')));
+        uint64_t backslash = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(in, _mm_set1_epi8('\\')));
+        uint64_t open = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(folded, _mm_set1_epi8('{')));
+        uint64_t close = (uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+        block->quote |= quote << (16 * i);
+        block->backslash |= backslash << (16 * i);
+        block->open |= open << (16 * i);
+        block->close |= close << (16 * i);
+    }
+}
+
+__attribute__((target("avx2")))
+static void cjson_classify_brackets_avx2(const unsigned char *input,
+        cjson_bracket_block *block)
+{
+    memset(block, 0, sizeof(cjson_bracket_block));
+    for (int i = 0; i < 2; i++)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(input + 32 * i));
+        // '{' and '[' only differ by the 0x20 bit, so do '}' and ']'
+        __m256i folded = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+        uint64_t quote = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')));
+        uint64_t backslash = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\')));
+        uint64_t open = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')));
+        uint64_t close = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}')));
+        block->quote |= quote << (32 * i);
+        block->backslash |= backslash << (32 * i);
+        block->open |= open << (32 * i);
+        block->close |= close << (32 * i);
+    }
+}
+
+#endif /* CJSON_X86 */
+
+static cjson_classify_brackets_fn cjson_bracket_classifier(void)
+{
+    switch (cjson_simd_level())
+    {
+#ifdef CJSON_X86
+    case CJSON_SIMD_AVX2:
+        return cjson_classify_brackets_avx2;
+    case CJSON_SIMD_SSE42:
+        return cjson_classify_brackets_sse42;
+#endif /* CJSON_X86 */
+    default:
+        return cjson_classify_brackets_scalar;
+    }
+}
+
+/**
+ * @brief skips the rest of the innermost open container and leaves it, the
+ *        next token is the one following it. returns false if the input ends
+ *        first
+ *
+ * Only quotes and escapes are tracked, to tell the brackets inside strings
+ * apart. What the container holds is not validated.
+ */
+static bool cjson_lexer_skip_container(cjson_lexer *lexer)
+{
+    assert(lexer->indexing);
+    size_t depth = 1;
+    int peeked = lexer->token.type;
+    lexer->token.type = CJSON_TOK_NONE;
+    if (peeked == CJSON_TOK_LBRACE || peeked == CJSON_TOK_LBRACK)
+        depth++;
+    else if (peeked == CJSON_TOK_RBRACE || peeked == CJSON_TOK_RBRACK)
+        goto done;
+
+    while (lexer->structural < lexer->structurals_size)
+    {
+        size_t location = lexer->structurals_base + lexer->structurals[lexer->structural++];
+        switch (lexer->content[location])
+        {
+        case '{': case '[':
+            depth++;
+            break;
+        case '}': case ']':
+            if (--depth == 0)
+            {
+                lexer->location = location + 1;
+                goto done;
+            }
+            break;
+        }
+    }
+
+    cjson_classify_brackets_fn classify = cjson_bracket_classifier();
+    const unsigned char *input = (const unsigned char *)lexer->content;
+    for (size_t pos = lexer->indexed; pos < lexer->size; pos += 64)
+    {
+        cjson_bracket_block block;
+        uint64_t valid = ~0ULL;
+        size_t avail = lexer->size - pos;
+        if (avail >= 64 || lexer->padding >= 64 - avail)
+            classify(input + pos, &block);
+        else
+        {
+            unsigned char padded[64] = { 0 };
+            memcpy(padded, input + pos, avail);
+            classify(padded, &block);
+        }
+        if (avail < 64)
+            valid = (1ULL << avail) - 1;
+
+        uint64_t quote = block.quote;
+        uint64_t in_string = cjson_stage1_strings(&lexer->stage1, block.backslash, &quote);
+        uint64_t open = block.open & ~in_string & valid;
+        uint64_t close = block.close & ~in_string & valid;
+        size_t closes = __builtin_popcountll(close);
+        if (closes < depth)
+        {
+            depth += __builtin_popcountll(open) - closes;
+            continue;
+        }
+        uint64_t brackets = open | close;
+        while (brackets != 0)
+        {
+            uint64_t bit = brackets & -brackets;
+            if ((open & bit) != 0)
+                depth++;
+            else if (--depth == 0)
+            {
+                // Indexing starts over past the bracket, out of any string
+                lexer->location = pos + __builtin_ctzll(bit) + 1;
+                lexer->indexed = lexer->location;
+                memset(&lexer->stage1, 0, sizeof(cjson_stage1_state));
+                goto done;
+            }
+            brackets &= brackets - 1;
+        }
+    }
+    return false;
+
+done:
+    lexer->depth--;
+    lexer->resume = CJSON_RESUME_VALUE_DONE;
+    return true;
+}
+
+/*
+ * Strings are decoded in a single pass: the next quote or backslash is found
+ * 16 or 32 bytes at a time, the run before it is copied in bulk and escapes
+ * are decoded as they come, \u escapes and surrogate pairs into UTF-8. A
+ * decoded string is never longer than its source, so it can be decoded over
+ * it.
+ */
+
+static size_t cjson_find_quote_or_backslash_scalar(const unsigned char *str, size_t len)
+{
+    size_t i = 0;
+    while (i < len && str[i] != '"' && str[i] != '\\')
+        i++;
+    return i;
+}
+
+#ifdef CJSON_X86
+
+__attribute__((target("sse4.2")))
+static size_t cjson_find_quote_or_backslash_sse42(const unsigned char *str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(str + i));
+        unsigned mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+                             _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + cjson_find_quote_or_backslash_scalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t cjson_find_quote_or_backslash_avx2(const unsigned char *str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(str + i));
+        unsigned mask = _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')),
+                                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    // Inlined rather than calling the SSE version, see cjson_find_escape_avx2
+    if (i + 16 <= len)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(str + i));
+        unsigned mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+                             _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + cjson_find_quote_or_backslash_scalar(str + i, len - i);
+}
+
+#endif /* CJSON_X86 */
+
+/**
+ * @brief returns the position of the first quote or backslash of str, len if
+ *        there is none
+ */
+static size_t cjson_find_quote_or_backslash(const char *str, size_t len)
+{
+    const unsigned char *input = (const unsigned char *)str;
+    // Most keys and short values are done before a vector would be loaded
+    if (len < 16)
+        return cjson_find_quote_or_backslash_scalar(input, len);
+    switch (cjson_simd_level())
+    {
+#ifdef CJSON_X86
+    case CJSON_SIMD_AVX2:
+        return cjson_find_quote_or_backslash_avx2(input, len);
+    case CJSON_SIMD_SSE42:
+        return cjson_find_quote_or_backslash_sse42(input, len);
+#endif /* CJSON_X86 */
+    default:
+        return cjson_find_quote_or_backslash_scalar(input, len);
+    }
+}
+
+/**
+ * @brief returns the value of an hexadecimal digit, -1 if c is not one
+ */
+int cjson_hex_to_int(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief reads the 4 hexadecimal digits of a \u escape, returns false if one
+ *        is not
+ */
+static bool cjson_read_hex4(const char *src, uint32_t *code)
+{
+    *code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int digit = cjson_hex_to_int(src[i]);
+        if (digit < 0)
+            return false;
+        *code = *code << 4 | digit;
+    }
+    return true;
+}
+
+/**
+ * @brief writes code point as UTF-8 to dst, returns the number of bytes
+ */
+static size_t cjson_encode_utf8(uint32_t code, char *dst)
+{
+    if (code < 0x80)
+    {
+        dst[0] = code;
+        return 1;
+    }
+    if (code < 0x800)
+    {
+        dst[0] = 0xc0 | code >> 6;
+        dst[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000)
+    {
+        dst[0] = 0xe0 | code >> 12;
+        dst[1] = 0x80 | (code >> 6 & 0x3f);
+        dst[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    dst[0] = 0xf0 | code >> 18;
+    dst[1] = 0x80 | (code >> 12 & 0x3f);
+    dst[2] = 0x80 | (code >> 6 & 0x3f);
+    dst[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+/*
+ * UTF-8 validation, when enabled, checks the runs between escapes as they are
+ * copied. Escapes and quotes are ASCII, so a run never splits a valid
+ * sequence. The vectorized validator is the lookup algorithm of simdjson
+ * (Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte"): every byte is paired with the one before it, and the high and low
+ * nibbles of the first one and the high nibble of the second one each index a
+ * table of the errors they could be part of. The pair is invalid if the three
+ * share an error. Continuations expected after 3 and 4 byte leads are checked
+ * apart.
+ */
+
+static bool cjson_validate_utf8_scalar(const unsigned char *str, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        unsigned char c = str[i];
+        if (c < 0x80)
+        {
+            i += 1;
+            continue;
+        }
+        size_t continuations;
+        uint32_t code;
+        if (c >= 0xc2 && c <= 0xdf)
+        {
+            continuations = 1;
+            code = c & 0x1f;
+        }
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            continuations = 2;
+            code = c & 0x0f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            continuations = 3;
+            code = c & 0x07;
+        }
+        else
+            return false;
+        if (len - i <= continuations)
+            return false;
+        for (size_t j = 1; j <= continuations; j++)
+        {
+            if ((str[i + j] & 0xc0) != 0x80)
+                return false;
+            code = code << 6 | (str[i + j] & 0x3f);
+        }
+        // Overlong encodings, surrogates and code points past U+10FFFF
+        if (continuations == 2 && (code < 0x800 || (code >= 0xd800 && code < 0xe000)))
+            return false;
+        if (continuations == 3 && (code < 0x10000 || code > 0x10ffff))
+            return false;
+        i += continuations + 1;
+    }
+    return true;
+}
+
+#ifdef CJSON_X86
+
+#define CJSON_UTF8_TOO_SHORT (1 << 0)
+#define CJSON_UTF8_TOO_LONG (1 << 1)
+#define CJSON_UTF8_OVERLONG_3 (1 << 2)
+#define CJSON_UTF8_TOO_LARGE (1 << 3)
+#define CJSON_UTF8_SURROGATE (1 << 4)
+#define CJSON_UTF8_OVERLONG_2 (1 << 5)
+#define CJSON_UTF8_TOO_LARGE_1000 (1 << 6)
+#define CJSON_UTF8_OVERLONG_4 (1 << 6)
+#define CJSON_UTF8_TWO_CONTS (1 << 7)
+#define CJSON_UTF8_CARRY (CJSON_UTF8_TOO_SHORT | CJSON_UTF8_TOO_LONG | CJSON_UTF8_TWO_CONTS)
+
+// Indexed by the high nibble of the first byte of a pair
+static const unsigned char cjson_utf8_byte_1_high[16] = {
+    // 0_______: ASCII
+    CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG,
+    CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG, CJSON_UTF8_TOO_LONG,
+    // 10______: continuation
+    CJSON_UTF8_TWO_CONTS, CJSON_UTF8_TWO_CONTS, CJSON_UTF8_TWO_CONTS, CJSON_UTF8_TWO_CONTS,
+    // 1100____ and 1101____: 2 byte lead
+    CJSON_UTF8_TOO_SHORT | CJSON_UTF8_OVERLONG_2,
+    CJSON_UTF8_TOO_SHORT,
+    // 1110____: 3 byte lead
+    CJSON_UTF8_TOO_SHORT | CJSON_UTF8_OVERLONG_3 | CJSON_UTF8_SURROGATE,
+    // 1111____: 4 byte lead
+    CJSON_UTF8_TOO_SHORT | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000
+        | CJSON_UTF8_OVERLONG_4,
+};
+
+// Indexed by the low nibble of the first byte of a pair
+static const unsigned char cjson_utf8_byte_1_low[16] = {
+    CJSON_UTF8_CARRY | CJSON_UTF8_OVERLONG_3 | CJSON_UTF8_OVERLONG_2 | CJSON_UTF8_OVERLONG_4,
+    CJSON_UTF8_CARRY | CJSON_UTF8_OVERLONG_2,
+    CJSON_UTF8_CARRY,
+    CJSON_UTF8_CARRY,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000 | CJSON_UTF8_SURROGATE,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+    CJSON_UTF8_CARRY | CJSON_UTF8_TOO_LARGE | CJSON_UTF8_TOO_LARGE_1000,
+};
+
+// Indexed by the high nibble of the second byte of a pair
+static const unsigned char cjson_utf8_byte_2_high[16] = {
+    // 0_______: ASCII
+    CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT,
+    CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT,
+    // 1000____
+    CJSON_UTF8_TOO_LONG | CJSON_UTF8_OVERLONG_2 | CJSON_UTF8_TWO_CONTS | CJSON_UTF8_OVERLONG_3
+        | CJSON_UTF8_TOO_LARGE_1000 | CJSON_UTF8_OVERLONG_4,
+    // 1001____
+    CJSON_UTF8_TOO_LONG | CJSON_UTF8_OVERLONG_2 | CJSON_UTF8_TWO_CONTS | CJSON_UTF8_OVERLONG_3
+        | CJSON_UTF8_TOO_LARGE,
+    // 101_____
+    CJSON_UTF8_TOO_LONG | CJSON_UTF8_OVERLONG_2 | CJSON_UTF8_TWO_CONTS | CJSON_UTF8_SURROGATE
+        | CJSON_UTF8_TOO_LARGE,
+    CJSON_UTF8_TOO_LONG | CJSON_UTF8_OVERLONG_2 | CJSON_UTF8_TWO_CONTS | CJSON_UTF8_SURROGATE
+        | CJSON_UTF8_TOO_LARGE,
+    // 11______: lead
+    CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT, CJSON_UTF8_TOO_SHORT,
+};
+
+// A block ends in the middle of a sequence if one of its bytes is above these
+static const unsigned char cjson_utf8_incomplete_max[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1,
+};
+
+/**
+ * @brief returns the errors of the 16 bytes of in, prev being the 16 bytes
+ *        before them
+ */
+__attribute__((target("sse4.2")))
+static inline __m128i cjson_utf8_errors_sse42(__m128i in, __m128i prev)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i special = _mm_and_si128(
+            _mm_and_si128(
+                _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cjson_utf8_byte_1_high),
+                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cjson_utf8_byte_1_low),
+                                 _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cjson_utf8_byte_2_high),
+                             _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+    // Bytes 2 and 3 after a 3 or 4 byte lead must be continuations
+    __m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8(0xe0 - 0x80));
+    __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8(0xf0 - 0x80));
+    __m128i continuation = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(continuation, special);
+}
+
+__attribute__((target("sse4.2")))
+static bool cjson_validate_utf8_sse42(const unsigned char *str, size_t len)
+{
+    const __m128i incomplete_max = _mm_loadu_si128((const __m128i *)(cjson_utf8_incomplete_max + 16));
+    __m128i error = _mm_setzero_si128();
+    __m128i prev = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+    size_t i = 0;
+    while (i < len)
+    {
+        __m128i in;
+        if (len - i >= 32)
+        {
+            // ASCII fast path, 32 bytes at a time
+            __m128i next = _mm_loadu_si128((const __m128i *)(str + i + 16));
+            in = _mm_loadu_si128((const __m128i *)(str + i));
+            if (_mm_movemask_epi8(_mm_or_si128(in, next)) == 0)
+            {
+                error = _mm_or_si128(error, incomplete);
+                incomplete = _mm_setzero_si128();
+                prev = next;
+                i += 32;
+                continue;
+            }
+        }
+        else if (len - i >= 16)
+            in = _mm_loadu_si128((const __m128i *)(str + i));
+        else
+        {
+            // Padded with ASCII, which ends any sequence left open
+            unsigned char padded[16] = { 0 };
+            memcpy(padded, str + i, len - i);
+            in = _mm_loadu_si128((const __m128i *)padded);
+        }
+        if (_mm_movemask_epi8(in) == 0)
+            error = _mm_or_si128(error, incomplete);
+        else
+            error = _mm_or_si128(error, cjson_utf8_errors_sse42(in, prev));
+        incomplete = _mm_subs_epu8(in, incomplete_max);
+        prev = in;
+        i += 16;
+    }
+    error = _mm_or_si128(error, incomplete);
+    return _mm_testz_si128(error, error);
+}
+
+/**
+ * @brief returns the errors of the 32 bytes of in, prev being the 32 bytes
+ *        before them
+ */
+__attribute__((target("avx2")))
+static inline __m256i cjson_utf8_errors_avx2(__m256i in, __m256i prev)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    // Shifting across the two lanes takes the upper lane of prev first
+    __m256i shifted = _mm256_permute2x128_si256(prev, in, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+    __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i *)cjson_utf8_byte_1_high)),
+                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i *)cjson_utf8_byte_1_low)),
+                    _mm256_and_si256(prev1, nibble))),
+            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                    _mm_loadu_si128((const __m128i *)cjson_utf8_byte_2_high)),
+                _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+    __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(in, shifted, 14),
+                                     _mm256_set1_epi8(0xe0 - 0x80));
+    __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(in, shifted, 13),
+                                      _mm256_set1_epi8(0xf0 - 0x80));
+    __m256i continuation = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                            _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(continuation, special);
+}
+
+__attribute__((target("avx2")))
+static bool cjson_validate_utf8_avx2(const unsigned char *str, size_t len)
+{
+    const __m256i incomplete_max = _mm256_loadu_si256((const __m256i *)cjson_utf8_incomplete_max);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i < len)
+    {
+        __m256i in;
+        if (len - i >= 64)
+        {
+            // ASCII fast path, 64 bytes at a time
+            __m256i next = _mm256_loadu_si256((const __m256i *)(str + i + 32));
+            in = _mm256_loadu_si256((const __m256i *)(str + i));
+            if (_mm256_movemask_epi8(_mm256_or_si256(in, next)) == 0)
+            {
+                error = _mm256_or_si256(error, incomplete);
+                incomplete = _mm256_setzero_si256();
+                prev = next;
+                i += 64;
+                continue;
+            }
+        }
+        else if (len - i >= 32)
+            in = _mm256_loadu_si256((const __m256i *)(str + i));
+        else
+        {
+            unsigned char padded[32] = { 0 };
+            memcpy(padded, str + i, len - i);
+            in = _mm256_loadu_si256((const __m256i *)padded);
+        }
+        if (_mm256_movemask_epi8(in) == 0)
+            error = _mm256_or_si256(error, incomplete);
+        else
+            error = _mm256_or_si256(error, cjson_utf8_errors_avx2(in, prev));
+        incomplete = _mm256_subs_epu8(in, incomplete_max);
+        prev = in;
+        i += 32;
+    }
+    error = _mm256_or_si256(error, incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+#endif /* CJSON_X86 */
+
+/**
+ * @brief returns whether the len bytes of str are valid UTF-8
+ */
+static bool cjson_validate_utf8(const char *str, size_t len)
+{
+    const unsigned char *input = (const unsigned char *)str;
+    if (len < 16)
+        return cjson_validate_utf8_scalar(input, len);
+    switch (cjson_simd_level())
+    {
+#ifdef CJSON_X86
+    case CJSON_SIMD_AVX2:
+        return cjson_validate_utf8_avx2(input, len);
+    case CJSON_SIMD_SSE42:
+        return cjson_validate_utf8_sse42(input, len);
+#endif /* CJSON_X86 */
+    default:
+        return cjson_validate_utf8_scalar(input, len);
+    }
+}
+
+/**
+ * @brief decodes the len bytes of escaped string content at src into dst,
+ *        which may be src itself, and NUL-terminates it. returns the decoded
+ *        length or SIZE_MAX if an escape is invalid, or if the content is not
+ *        valid UTF-8 when validate_utf8 is true
+ */
+static size_t cjson_unescape(char *dst, const char *src, size_t len, bool validate_utf8)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (true)
+    {
+        size_t run = cjson_find_quote_or_backslash(src + i, len - i);
+        if (validate_utf8 && !cjson_validate_utf8(src + i, run))
+            return SIZE_MAX;
+        if (dst + j != src + i)
+            memmove(dst + j, src + i, run);
+        i += run;
+        j += run;
+        if (i == len)
+            break;
+        if (src[i] != '\\')
+        {
+            // The lexer never leaves a bare quote, it would be kept as is
+            dst[j++] = src[i++];
+            continue;
+        }
+
+        if (i + 1 == len)
+            return SIZE_MAX;
+        char escape = src[i + 1];
+        i += 2;
+        switch (escape)
+        {
+        case '"': case '\\': case '/':
+            dst[j++] = escape;
+            break;
+        case 'b':
+            dst[j++] = '\b';
+            break;
+        case 'f':
+            dst[j++] = '\f';
+            break;
+        case 'n':
+            dst[j++] = '\n';
+            break;
+        case 'r':
+            dst[j++] = '\r';
+            break;
+        case 't':
+            dst[j++] = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t code;
+            if (len - i < 4 || !cjson_read_hex4(src + i, &code))
+                return SIZE_MAX;
+            i += 4;
+            if (code >= 0xdc00 && code < 0xe000)
+                return SIZE_MAX;
+            if (code >= 0xd800 && code < 0xdc00)
+            {
+                // A high surrogate must be followed by a low one
+                uint32_t low;
+                if (len - i < 6 || src[i] != '\\' || src[i + 1] != 'u'
+                        || !cjson_read_hex4(src + i + 2, &low)
+                        || low < 0xdc00 || low >= 0xe000)
+                    return SIZE_MAX;
+                i += 6;
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+            j += cjson_encode_utf8(code, dst + j);
+            break;
+        }
+        default:
+            return SIZE_MAX;
+        }
+    }
+    dst[j] = '\0';
+    return j;
+}
+
+/**
+ * @brief decodes a string token into len bytes. returns NULL if an escape is
+ *        invalid
+ *
+ * Strings without escapes are returned where they are in the content. The
+ * others are decoded over it when parsing in situ, in the lexer scratch buffer
+ * otherwise, which the next string reuses. In situ, the result is always
+ * NUL-terminated.
+ */
+static char *cjson_lexer_string(cjson_lexer *lexer, cjson_token *token, size_t *len)
+{
+    assert(token->type == CJSON_TOK_STRING);
+    size_t raw_len = token->content_len - 2;
+    char *src = token->content + 1;
+    if (cjson_find_quote_or_backslash(src, raw_len) == raw_len)
+    {
+        if (lexer->validate_utf8 && !cjson_validate_utf8(src, raw_len))
+            return NULL;
+        // The closing quote becomes the terminator
+        if (lexer->insitu)
+            src[raw_len] = '\0';
+        *len = raw_len;
+        return src;
+    }
+    char *dst = src;
+    if (!lexer->insitu)
+    {
+        if (lexer->scratch_capacity < raw_len + 1)
+        {
+            lexer->scratch_capacity = raw_len + 1 < 256 ? 256 : raw_len + 1;
+            free(lexer->scratch);
+            lexer->scratch = malloc(lexer->scratch_capacity);
+        }
+        dst = lexer->scratch;
+    }
+    *len = cjson_unescape(dst, src, raw_len, lexer->validate_utf8);
+    return *len == SIZE_MAX ? NULL : dst;
+}
+
+/*
+ * Numbers are scanned once. Up to 19 significant digits are accumulated into
+ * a 64-bit mantissa: integers that fit are kept as is and decimals are
+ * converted with the Eisel-Lemire algorithm, which is exact for every
+ * mantissa and power of ten it does not reject. The rare rejected inputs and
+ * those with more significant digits fall back to strtod.
+ */
+
+#define CJSON_POW5_MIN_EXPONENT -342
+#define CJSON_POW5_MAX_EXPONENT 308
+
+// 128-bit truncations of 5^q shifted so their most significant bit is set,
+// two words per q from CJSON_POW5_MIN_EXPONENT to CJSON_POW5_MAX_EXPONENT
+static const uint64_t cjson_powers_of_five[] = {
+    0xeef453d6923bd65aULL, 0x113faa2906a13b3fULL,
+    0x9558b4661b6565f8ULL, 0x4ac7ca59a424c507ULL,
+    0xbaaee17fa23ebf76ULL, 0x5d79bcf00d2df649ULL,
+    0xe95a99df8ace6f53ULL, 0xf4d82c2c107973dcULL,
+    0x91d8a02bb6c10594ULL, 0x79071b9b8a4be869ULL,
+    0xb64ec836a47146f9ULL, 0x9748e2826cdee284ULL,
+    0xe3e27a444d8d98b7ULL, 0xfd1b1b2308169b25ULL,
+    0x8e6d8c6ab0787f72ULL, 0xfe30f0f5e50e20f7ULL,
+    0xb208ef855c969f4fULL, 0xbdbd2d335e51a935ULL,
+    0xde8b2b66b3bc4723ULL, 0xad2c788035e61382ULL,
+    0x8b16fb203055ac76ULL, 0x4c3bcb5021afcc31ULL,
+    0xaddcb9e83c6b1793ULL, 0xdf4abe242a1bbf3dULL,
+    0xd953e8624b85dd78ULL, 0xd71d6dad34a2af0dULL,
+    0x87d4713d6f33aa6bULL, 0x8672648c40e5ad68ULL,
+    0xa9c98d8ccb009506ULL, 0x680efdaf511f18c2ULL,
+    0xd43bf0effdc0ba48ULL, 0x0212bd1b2566def2ULL,
+    0x84a57695fe98746dULL, 0x014bb630f7604b57ULL,
+    0xa5ced43b7e3e9188ULL, 0x419ea3bd35385e2dULL,
+    0xcf42894a5dce35eaULL, 0x52064cac828675b9ULL,
+    0x818995ce7aa0e1b2ULL, 0x7343efebd1940993ULL,
+    0xa1ebfb4219491a1fULL, 0x1014ebe6c5f90bf8ULL,
+    0xca66fa129f9b60a6ULL, 0xd41a26e077774ef6ULL,
+    0xfd00b897478238d0ULL, 0x8920b098955522b4ULL,
+    0x9e20735e8cb16382ULL, 0x55b46e5f5d5535b0ULL,
+    0xc5a890362fddbc62ULL, 0xeb2189f734aa831dULL,
+    0xf712b443bbd52b7bULL, 0xa5e9ec7501d523e4ULL,
+    0x9a6bb0aa55653b2dULL, 0x47b233c92125366eULL,
+    0xc1069cd4eabe89f8ULL, 0x999ec0bb696e840aULL,
+    0xf148440a256e2c76ULL, 0xc00670ea43ca250dULL,
+    0x96cd2a865764dbcaULL, 0x380406926a5e5728ULL,
+    0xbc807527ed3e12bcULL, 0xc605083704f5ecf2ULL,
+    0xeba09271e88d976bULL, 0xf7864a44c633682eULL,
+    0x93445b8731587ea3ULL, 0x7ab3ee6afbe0211dULL,
+    0xb8157268fdae9e4cULL, 0x5960ea05bad82964ULL,
+    0xe61acf033d1a45dfULL, 0x6fb92487298e33bdULL,
+    0x8fd0c16206306babULL, 0xa5d3b6d479f8e056ULL,
+    0xb3c4f1ba87bc8696ULL, 0x8f48a4899877186cULL,
+    0xe0b62e2929aba83cULL, 0x331acdabfe94de87ULL,
+    0x8c71dcd9ba0b4925ULL, 0x9ff0c08b7f1d0b14ULL,
+    0xaf8e5410288e1b6fULL, 0x07ecf0ae5ee44dd9ULL,
+    0xdb71e91432b1a24aULL, 0xc9e82cd9f69d6150ULL,
+    0x892731ac9faf056eULL, 0xbe311c083a225cd2ULL,
+    0xab70fe17c79ac6caULL, 0x6dbd630a48aaf406ULL,
+    0xd64d3d9db981787dULL, 0x092cbbccdad5b108ULL,
+    0x85f0468293f0eb4eULL, 0x25bbf56008c58ea5ULL,
+    0xa76c582338ed2621ULL, 0xaf2af2b80af6f24eULL,
+    0xd1476e2c07286faaULL, 0x1af5af660db4aee1ULL,
+    0x82cca4db847945caULL, 0x50d98d9fc890ed4dULL,
+    0xa37fce126597973cULL, 0xe50ff107bab528a0ULL,
+    0xcc5fc196fefd7d0cULL, 0x1e53ed49a96272c8ULL,
+    0xff77b1fcbebcdc4fULL, 0x25e8e89c13bb0f7aULL,
+    0x9faacf3df73609b1ULL, 0x77b191618c54e9acULL,
+    0xc795830d75038c1dULL, 0xd59df5b9ef6a2417ULL,
+    0xf97ae3d0d2446f25ULL, 0x4b0573286b44ad1dULL,
+    0x9becce62836ac577ULL, 0x4ee367f9430aec32ULL,
+    0xc2e801fb244576d5ULL, 0x229c41f793cda73fULL,
+    0xf3a20279ed56d48aULL, 0x6b43527578c1110fULL,
+    0x9845418c345644d6ULL, 0x830a13896b78aaa9ULL,
+    0xbe5691ef416bd60cULL, 0x23cc986bc656d553ULL,
+    0xedec366b11c6cb8fULL, 0x2cbfbe86b7ec8aa8ULL,
+    0x94b3a202eb1c3f39ULL, 0x7bf7d71432f3d6a9ULL,
+    0xb9e08a83a5e34f07ULL, 0xdaf5ccd93fb0cc53ULL,
+    0xe858ad248f5c22c9ULL, 0xd1b3400f8f9cff68ULL,
+    0x91376c36d99995beULL, 0x23100809b9c21fa1ULL,
+    0xb58547448ffffb2dULL, 0xabd40a0c2832a78aULL,
+    0xe2e69915b3fff9f9ULL, 0x16c90c8f323f516cULL,
+    0x8dd01fad907ffc3bULL, 0xae3da7d97f6792e3ULL,
+    0xb1442798f49ffb4aULL, 0x99cd11cfdf41779cULL,
+    0xdd95317f31c7fa1dULL, 0x40405643d711d583ULL,
+    0x8a7d3eef7f1cfc52ULL, 0x482835ea666b2572ULL,
+    0xad1c8eab5ee43b66ULL, 0xda3243650005eecfULL,
+    0xd863b256369d4a40ULL, 0x90bed43e40076a82ULL,
+    0x873e4f75e2224e68ULL, 0x5a7744a6e804a291ULL,
+    0xa90de3535aaae202ULL, 0x711515d0a205cb36ULL,
+    0xd3515c2831559a83ULL, 0x0d5a5b44ca873e03ULL,
+    0x8412d9991ed58091ULL, 0xe858790afe9486c2ULL,
+    0xa5178fff668ae0b6ULL, 0x626e974dbe39a872ULL,
+    0xce5d73ff402d98e3ULL, 0xfb0a3d212dc8128fULL,
+    0x80fa687f881c7f8eULL, 0x7ce66634bc9d0b99ULL,
+    0xa139029f6a239f72ULL, 0x1c1fffc1ebc44e80ULL,
+    0xc987434744ac874eULL, 0xa327ffb266b56220ULL,
+    0xfbe9141915d7a922ULL, 0x4bf1ff9f0062baa8ULL,
+    0x9d71ac8fada6c9b5ULL, 0x6f773fc3603db4a9ULL,
+    0xc4ce17b399107c22ULL, 0xcb550fb4384d21d3ULL,
+    0xf6019da07f549b2bULL, 0x7e2a53a146606a48ULL,
+    0x99c102844f94e0fbULL, 0x2eda7444cbfc426dULL,
+    0xc0314325637a1939ULL, 0xfa911155fefb5308ULL,
+    0xf03d93eebc589f88ULL, 0x793555ab7eba27caULL,
+    0x96267c7535b763b5ULL, 0x4bc1558b2f3458deULL,
+    0xbbb01b9283253ca2ULL, 0x9eb1aaedfb016f16ULL,
+    0xea9c227723ee8bcbULL, 0x465e15a979c1cadcULL,
+    0x92a1958a7675175fULL, 0x0bfacd89ec191ec9ULL,
+    0xb749faed14125d36ULL, 0xcef980ec671f667bULL,
+    0xe51c79a85916f484ULL, 0x82b7e12780e7401aULL,
+    0x8f31cc0937ae58d2ULL, 0xd1b2ecb8b0908810ULL,
+    0xb2fe3f0b8599ef07ULL, 0x861fa7e6dcb4aa15ULL,
+    0xdfbdcece67006ac9ULL, 0x67a791e093e1d49aULL,
+    0x8bd6a141006042bdULL, 0xe0c8bb2c5c6d24e0ULL,
+    0xaecc49914078536dULL, 0x58fae9f773886e18ULL,
+    0xda7f5bf590966848ULL, 0xaf39a475506a899eULL,
+    0x888f99797a5e012dULL, 0x6d8406c952429603ULL,
+    0xaab37fd7d8f58178ULL, 0xc8e5087ba6d33b83ULL,
+    0xd5605fcdcf32e1d6ULL, 0xfb1e4a9a90880a64ULL,
+    0x855c3be0a17fcd26ULL, 0x5cf2eea09a55067fULL,
+    0xa6b34ad8c9dfc06fULL, 0xf42faa48c0ea481eULL,
+    0xd0601d8efc57b08bULL, 0xf13b94daf124da26ULL,
+    0x823c12795db6ce57ULL, 0x76c53d08d6b70858ULL,
+    0xa2cb1717b52481edULL, 0x54768c4b0c64ca6eULL,
+    0xcb7ddcdda26da268ULL, 0xa9942f5dcf7dfd09ULL,
+    0xfe5d54150b090b02ULL, 0xd3f93b35435d7c4cULL,
+    0x9efa548d26e5a6e1ULL, 0xc47bc5014a1a6dafULL,
+    0xc6b8e9b0709f109aULL, 0x359ab6419ca1091bULL,
+    0xf867241c8cc6d4c0ULL, 0xc30163d203c94b62ULL,
+    0x9b407691d7fc44f8ULL, 0x79e0de63425dcf1dULL,
+    0xc21094364dfb5636ULL, 0x985915fc12f542e4ULL,
+    0xf294b943e17a2bc4ULL, 0x3e6f5b7b17b2939dULL,
+    0x979cf3ca6cec5b5aULL, 0xa705992ceecf9c42ULL,
+    0xbd8430bd08277231ULL, 0x50c6ff782a838353ULL,
+    0xece53cec4a314ebdULL, 0xa4f8bf5635246428ULL,
+    0x940f4613ae5ed136ULL, 0x871b7795e136be99ULL,
+    0xb913179899f68584ULL, 0x28e2557b59846e3fULL,
+    0xe757dd7ec07426e5ULL, 0x331aeada2fe589cfULL,
+    0x9096ea6f3848984fULL, 0x3ff0d2c85def7621ULL,
+    0xb4bca50b065abe63ULL, 0x0fed077a756b53a9ULL,
+    0xe1ebce4dc7f16dfbULL, 0xd3e8495912c62894ULL,
+    0x8d3360f09cf6e4bdULL, 0x64712dd7abbbd95cULL,
+    0xb080392cc4349decULL, 0xbd8d794d96aacfb3ULL,
+    0xdca04777f541c567ULL, 0xecf0d7a0fc5583a0ULL,
+    0x89e42caaf9491b60ULL, 0xf41686c49db57244ULL,
+    0xac5d37d5b79b6239ULL, 0x311c2875c522ced5ULL,
+    0xd77485cb25823ac7ULL, 0x7d633293366b828bULL,
+    0x86a8d39ef77164bcULL, 0xae5dff9c02033197ULL,
+    0xa8530886b54dbdebULL, 0xd9f57f830283fdfcULL,
+    0xd267caa862a12d66ULL, 0xd072df63c324fd7bULL,
+    0x8380dea93da4bc60ULL, 0x4247cb9e59f71e6dULL,
+    0xa46116538d0deb78ULL, 0x52d9be85f074e608ULL,
+    0xcd795be870516656ULL, 0x67902e276c921f8bULL,
+    0x806bd9714632dff6ULL, 0x00ba1cd8a3db53b6ULL,
+    0xa086cfcd97bf97f3ULL, 0x80e8a40eccd228a4ULL,
+    0xc8a883c0fdaf7df0ULL, 0x6122cd128006b2cdULL,
+    0xfad2a4b13d1b5d6cULL, 0x796b805720085f81ULL,
+    0x9cc3a6eec6311a63ULL, 0xcbe3303674053bb0ULL,
+    0xc3f490aa77bd60fcULL, 0xbedbfc4411068a9cULL,
+    0xf4f1b4d515acb93bULL, 0xee92fb5515482d44ULL,
+    0x991711052d8bf3c5ULL, 0x751bdd152d4d1c4aULL,
+    0xbf5cd54678eef0b6ULL, 0xd262d45a78a0635dULL,
+    0xef340a98172aace4ULL, 0x86fb897116c87c34ULL,
+    0x9580869f0e7aac0eULL, 0xd45d35e6ae3d4da0ULL,
+    0xbae0a846d2195712ULL, 0x8974836059cca109ULL,
+    0xe998d258869facd7ULL, 0x2bd1a438703fc94bULL,
+    0x91ff83775423cc06ULL, 0x7b6306a34627ddcfULL,
+    0xb67f6455292cbf08ULL, 0x1a3bc84c17b1d542ULL,
+    0xe41f3d6a7377eecaULL, 0x20caba5f1d9e4a93ULL,
+    0x8e938662882af53eULL, 0x547eb47b7282ee9cULL,
+    0xb23867fb2a35b28dULL, 0xe99e619a4f23aa43ULL,
+    0xdec681f9f4c31f31ULL, 0x6405fa00e2ec94d4ULL,
+    0x8b3c113c38f9f37eULL, 0xde83bc408dd3dd04ULL,
+    0xae0b158b4738705eULL, 0x9624ab50b148d445ULL,
+    0xd98ddaee19068c76ULL, 0x3badd624dd9b0957ULL,
+    0x87f8a8d4cfa417c9ULL, 0xe54ca5d70a80e5d6ULL,
+    0xa9f6d30a038d1dbcULL, 0x5e9fcf4ccd211f4cULL,
+    0xd47487cc8470652bULL, 0x7647c3200069671fULL,
+    0x84c8d4dfd2c63f3bULL, 0x29ecd9f40041e073ULL,
+    0xa5fb0a17c777cf09ULL, 0xf468107100525890ULL,
+    0xcf79cc9db955c2ccULL, 0x7182148d4066eeb4ULL,
+    0x81ac1fe293d599bfULL, 0xc6f14cd848405530ULL,
+    0xa21727db38cb002fULL, 0xb8ada00e5a506a7cULL,
+    0xca9cf1d206fdc03bULL, 0xa6d90811f0e4851cULL,
+    0xfd442e4688bd304aULL, 0x908f4a166d1da663ULL,
+    0x9e4a9cec15763e2eULL, 0x9a598e4e043287feULL,
+    0xc5dd44271ad3cdbaULL, 0x40eff1e1853f29fdULL,
+    0xf7549530e188c128ULL, 0xd12bee59e68ef47cULL,
+    0x9a94dd3e8cf578b9ULL, 0x82bb74f8301958ceULL,
+    0xc13a148e3032d6e7ULL, 0xe36a52363c1faf01ULL,
+    0xf18899b1bc3f8ca1ULL, 0xdc44e6c3cb279ac1ULL,
+    0x96f5600f15a7b7e5ULL, 0x29ab103a5ef8c0b9ULL,
+    0xbcb2b812db11a5deULL, 0x7415d448f6b6f0e7ULL,
+    0xebdf661791d60f56ULL, 0x111b495b3464ad21ULL,
+    0x936b9fcebb25c995ULL, 0xcab10dd900beec34ULL,
+    0xb84687c269ef3bfbULL, 0x3d5d514f40eea742ULL,
+    0xe65829b3046b0afaULL, 0x0cb4a5a3112a5112ULL,
+    0x8ff71a0fe2c2e6dcULL, 0x47f0e785eaba72abULL,
+    0xb3f4e093db73a093ULL, 0x59ed216765690f56ULL,
+    0xe0f218b8d25088b8ULL, 0x306869c13ec3532cULL,
+    0x8c974f7383725573ULL, 0x1e414218c73a13fbULL,
+    0xafbd2350644eeacfULL, 0xe5d1929ef90898faULL,
+    0xdbac6c247d62a583ULL, 0xdf45f746b74abf39ULL,
+    0x894bc396ce5da772ULL, 0x6b8bba8c328eb783ULL,
+    0xab9eb47c81f5114fULL, 0x066ea92f3f326564ULL,
+    0xd686619ba27255a2ULL, 0xc80a537b0efefebdULL,
+    0x8613fd0145877585ULL, 0xbd06742ce95f5f36ULL,
+    0xa798fc4196e952e7ULL, 0x2c48113823b73704ULL,
+    0xd17f3b51fca3a7a0ULL, 0xf75a15862ca504c5ULL,
+    0x82ef85133de648c4ULL, 0x9a984d73dbe722fbULL,
+    0xa3ab66580d5fdaf5ULL, 0xc13e60d0d2e0ebbaULL,
+    0xcc963fee10b7d1b3ULL, 0x318df905079926a8ULL,
+    0xffbbcfe994e5c61fULL, 0xfdf17746497f7052ULL,
+    0x9fd561f1fd0f9bd3ULL, 0xfeb6ea8bedefa633ULL,
+    0xc7caba6e7c5382c8ULL, 0xfe64a52ee96b8fc0ULL,
+    0xf9bd690a1b68637bULL, 0x3dfdce7aa3c673b0ULL,
+    0x9c1661a651213e2dULL, 0x06bea10ca65c084eULL,
+    0xc31bfa0fe5698db8ULL, 0x486e494fcff30a62ULL,
+    0xf3e2f893dec3f126ULL, 0x5a89dba3c3efccfaULL,
+    0x986ddb5c6b3a76b7ULL, 0xf89629465a75e01cULL,
+    0xbe89523386091465ULL, 0xf6bbb397f1135823ULL,
+    0xee2ba6c0678b597fULL, 0x746aa07ded582e2cULL,
+    0x94db483840b717efULL, 0xa8c2a44eb4571cdcULL,
+    0xba121a4650e4ddebULL, 0x92f34d62616ce413ULL,
+    0xe896a0d7e51e1566ULL, 0x77b020baf9c81d17ULL,
+    0x915e2486ef32cd60ULL, 0x0ace1474dc1d122eULL,
+    0xb5b5ada8aaff80b8ULL, 0x0d819992132456baULL,
+    0xe3231912d5bf60e6ULL, 0x10e1fff697ed6c69ULL,
+    0x8df5efabc5979c8fULL, 0xca8d3ffa1ef463c1ULL,
+    0xb1736b96b6fd83b3ULL, 0xbd308ff8a6b17cb2ULL,
+    0xddd0467c64bce4a0ULL, 0xac7cb3f6d05ddbdeULL,
+    0x8aa22c0dbef60ee4ULL, 0x6bcdf07a423aa96bULL,
+    0xad4ab7112eb3929dULL, 0x86c16c98d2c953c6ULL,
+    0xd89d64d57a607744ULL, 0xe871c7bf077ba8b7ULL,
+    0x87625f056c7c4a8bULL, 0x11471cd764ad4972ULL,
+    0xa93af6c6c79b5d2dULL, 0xd598e40d3dd89bcfULL,
+    0xd389b47879823479ULL, 0x4aff1d108d4ec2c3ULL,
+    0x843610cb4bf160cbULL, 0xcedf722a585139baULL,
+    0xa54394fe1eedb8feULL, 0xc2974eb4ee658828ULL,
+    0xce947a3da6a9273eULL, 0x733d226229feea32ULL,
+    0x811ccc668829b887ULL, 0x0806357d5a3f525fULL,
+    0xa163ff802a3426a8ULL, 0xca07c2dcb0cf26f7ULL,
+    0xc9bcff6034c13052ULL, 0xfc89b393dd02f0b5ULL,
+    0xfc2c3f3841f17c67ULL, 0xbbac2078d443ace2ULL,
+    0x9d9ba7832936edc0ULL, 0xd54b944b84aa4c0dULL,
+    0xc5029163f384a931ULL, 0x0a9e795e65d4df11ULL,
+    0xf64335bcf065d37dULL, 0x4d4617b5ff4a16d5ULL,
+    0x99ea0196163fa42eULL, 0x504bced1bf8e4e45ULL,
+    0xc06481fb9bcf8d39ULL, 0xe45ec2862f71e1d6ULL,
+    0xf07da27a82c37088ULL, 0x5d767327bb4e5a4cULL,
+    0x964e858c91ba2655ULL, 0x3a6a07f8d510f86fULL,
+    0xbbe226efb628afeaULL, 0x890489f70a55368bULL,
+    0xeadab0aba3b2dbe5ULL, 0x2b45ac74ccea842eULL,
+    0x92c8ae6b464fc96fULL, 0x3b0b8bc90012929dULL,
+    0xb77ada0617e3bbcbULL, 0x09ce6ebb40173744ULL,
+    0xe55990879ddcaabdULL, 0xcc420a6a101d0515ULL,
+    0x8f57fa54c2a9eab6ULL, 0x9fa946824a12232dULL,
+    0xb32df8e9f3546564ULL, 0x47939822dc96abf9ULL,
+    0xdff9772470297ebdULL, 0x59787e2b93bc56f7ULL,
+    0x8bfbea76c619ef36ULL, 0x57eb4edb3c55b65aULL,
+    0xaefae51477a06b03ULL, 0xede622920b6b23f1ULL,
+    0xdab99e59958885c4ULL, 0xe95fab368e45ecedULL,
+    0x88b402f7fd75539bULL, 0x11dbcb0218ebb414ULL,
+    0xaae103b5fcd2a881ULL, 0xd652bdc29f26a119ULL,
+    0xd59944a37c0752a2ULL, 0x4be76d3346f0495fULL,
+    0x857fcae62d8493a5ULL, 0x6f70a4400c562ddbULL,
+    0xa6dfbd9fb8e5b88eULL, 0xcb4ccd500f6bb952ULL,
+    0xd097ad07a71f26b2ULL, 0x7e2000a41346a7a7ULL,
+    0x825ecc24c873782fULL, 0x8ed400668c0c28c8ULL,
+    0xa2f67f2dfa90563bULL, 0x728900802f0f32faULL,
+    0xcbb41ef979346bcaULL, 0x4f2b40a03ad2ffb9ULL,
+    0xfea126b7d78186bcULL, 0xe2f610c84987bfa8ULL,
+    0x9f24b832e6b0f436ULL, 0x0dd9ca7d2df4d7c9ULL,
+    0xc6ede63fa05d3143ULL, 0x91503d1c79720dbbULL,
+    0xf8a95fcf88747d94ULL, 0x75a44c6397ce912aULL,
+    0x9b69dbe1b548ce7cULL, 0xc986afbe3ee11abaULL,
+    0xc24452da229b021bULL, 0xfbe85badce996168ULL,
+    0xf2d56790ab41c2a2ULL, 0xfae27299423fb9c3ULL,
+    0x97c560ba6b0919a5ULL, 0xdccd879fc967d41aULL,
+    0xbdb6b8e905cb600fULL, 0x5400e987bbc1c920ULL,
+    0xed246723473e3813ULL, 0x290123e9aab23b68ULL,
+    0x9436c0760c86e30bULL, 0xf9a0b6720aaf6521ULL,
+    0xb94470938fa89bceULL, 0xf808e40e8d5b3e69ULL,
+    0xe7958cb87392c2c2ULL, 0xb60b1d1230b20e04ULL,
+    0x90bd77f3483bb9b9ULL, 0xb1c6f22b5e6f48c2ULL,
+    0xb4ecd5f01a4aa828ULL, 0x1e38aeb6360b1af3ULL,
+    0xe2280b6c20dd5232ULL, 0x25c6da63c38de1b0ULL,
+    0x8d590723948a535fULL, 0x579c487e5a38ad0eULL,
+    0xb0af48ec79ace837ULL, 0x2d835a9df0c6d851ULL,
+    0xdcdb1b2798182244ULL, 0xf8e431456cf88e65ULL,
+    0x8a08f0f8bf0f156bULL, 0x1b8e9ecb641b58ffULL,
+    0xac8b2d36eed2dac5ULL, 0xe272467e3d222f3fULL,
+    0xd7adf884aa879177ULL, 0x5b0ed81dcc6abb0fULL,
+    0x86ccbb52ea94baeaULL, 0x98e947129fc2b4e9ULL,
+    0xa87fea27a539e9a5ULL, 0x3f2398d747b36224ULL,
+    0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aadULL,
+    0x83a3eeeef9153e89ULL, 0x1953cf68300424acULL,
+    0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd7ULL,
+    0xcdb02555653131b6ULL, 0x3792f412cb06794dULL,
+    0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd0ULL,
+    0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec4ULL,
+    0xc8de047564d20a8bULL, 0xf245825a5a445275ULL,
+    0xfb158592be068d2eULL, 0xeed6e2f0f0d56712ULL,
+    0x9ced737bb6c4183dULL, 0x55464dd69685606bULL,
+    0xc428d05aa4751e4cULL, 0xaa97e14c3c26b886ULL,
+    0xf53304714d9265dfULL, 0xd53dd99f4b3066a8ULL,
+    0x993fe2c6d07b7fabULL, 0xe546a8038efe4029ULL,
+    0xbf8fdb78849a5f96ULL, 0xde98520472bdd033ULL,
+    0xef73d256a5c0f77cULL, 0x963e66858f6d4440ULL,
+    0x95a8637627989aadULL, 0xdde7001379a44aa8ULL,
+    0xbb127c53b17ec159ULL, 0x5560c018580d5d52ULL,
+    0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a6ULL,
+    0x9226712162ab070dULL, 0xcab3961304ca70e8ULL,
+    0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d22ULL,
+    0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506aULL,
+    0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb242ULL,
+    0xb267ed1940f1c61cULL, 0x55f038b237591ed3ULL,
+    0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6688ULL,
+    0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da015ULL,
+    0xae397d8aa96c1b77ULL, 0xabec975e0a0d081aULL,
+    0xd9c7dced53c72255ULL, 0x96e7bd358c904a21ULL,
+    0x881cea14545c7575ULL, 0x7e50d64177da2e54ULL,
+    0xaa242499697392d2ULL, 0xdde50bd1d5d0b9e9ULL,
+    0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e864ULL,
+    0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113eULL,
+    0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58eULL,
+    0xcfb11ead453994baULL, 0x67de18eda5814af2ULL,
+    0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced7ULL,
+    0xa2425ff75e14fc31ULL, 0xa1258379a94d028dULL,
+    0xcad2f7f5359a3b3eULL, 0x096ee45813a04330ULL,
+    0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fcULL,
+    0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL,
+    0xc612062576589ddaULL, 0x95364afe032a819eULL,
+    0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL,
+    0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL,
+    0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL,
+    0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL,
+    0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL,
+    0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL,
+    0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL,
+    0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL,
+    0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL,
+    0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL,
+    0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL,
+    0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL,
+    0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL,
+    0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL,
+    0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL,
+    0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL,
+    0x89705f4136b4a597ULL, 0x31680a88f8953031ULL,
+    0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL,
+    0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL,
+    0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL,
+    0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL,
+    0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL,
+    0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL,
+    0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL,
+    0xccccccccccccccccULL, 0xcccccccccccccccdULL,
+    0x8000000000000000ULL, 0x0000000000000000ULL,
+    0xa000000000000000ULL, 0x0000000000000000ULL,
+    0xc800000000000000ULL, 0x0000000000000000ULL,
+    0xfa00000000000000ULL, 0x0000000000000000ULL,
+    0x9c40000000000000ULL, 0x0000000000000000ULL,
+    0xc350000000000000ULL, 0x0000000000000000ULL,
+    0xf424000000000000ULL, 0x0000000000000000ULL,
+    0x9896800000000000ULL, 0x0000000000000000ULL,
+    0xbebc200000000000ULL, 0x0000000000000000ULL,
+    0xee6b280000000000ULL, 0x0000000000000000ULL,
+    0x9502f90000000000ULL, 0x0000000000000000ULL,
+    0xba43b74000000000ULL, 0x0000000000000000ULL,
+    0xe8d4a51000000000ULL, 0x0000000000000000ULL,
+    0x9184e72a00000000ULL, 0x0000000000000000ULL,
+    0xb5e620f480000000ULL, 0x0000000000000000ULL,
+    0xe35fa931a0000000ULL, 0x0000000000000000ULL,
+    0x8e1bc9bf04000000ULL, 0x0000000000000000ULL,
+    0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL,
+    0xde0b6b3a76400000ULL, 0x0000000000000000ULL,
+    0x8ac7230489e80000ULL, 0x0000000000000000ULL,
+    0xad78ebc5ac620000ULL, 0x0000000000000000ULL,
+    0xd8d726b7177a8000ULL, 0x0000000000000000ULL,
+    0x878678326eac9000ULL, 0x0000000000000000ULL,
+    0xa968163f0a57b400ULL, 0x0000000000000000ULL,
+    0xd3c21bcecceda100ULL, 0x0000000000000000ULL,
+    0x84595161401484a0ULL, 0x0000000000000000ULL,
+    0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL,
+    0xcecb8f27f4200f3aULL, 0x0000000000000000ULL,
+    0x813f3978f8940984ULL, 0x4000000000000000ULL,
+    0xa18f07d736b90be5ULL, 0x5000000000000000ULL,
+    0xc9f2c9cd04674edeULL, 0xa400000000000000ULL,
+    0xfc6f7c4045812296ULL, 0x4d00000000000000ULL,
+    0x9dc5ada82b70b59dULL, 0xf020000000000000ULL,
+    0xc5371912364ce305ULL, 0x6c28000000000000ULL,
+    0xf684df56c3e01bc6ULL, 0xc732000000000000ULL,
+    0x9a130b963a6c115cULL, 0x3c7f400000000000ULL,
+    0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL,
+    0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL,
+    0x96769950b50d88f4ULL, 0x1314448000000000ULL,
+    0xbc143fa4e250eb31ULL, 0x17d955a000000000ULL,
+    0xeb194f8e1ae525fdULL, 0x5dcfab0800000000ULL,
+    0x92efd1b8d0cf37beULL, 0x5aa1cae500000000ULL,
+    0xb7abc627050305adULL, 0xf14a3d9e40000000ULL,
+    0xe596b7b0c643c719ULL, 0x6d9ccd05d0000000ULL,
+    0x8f7e32ce7bea5c6fULL, 0xe4820023a2000000ULL,
+    0xb35dbf821ae4f38bULL, 0xdda2802c8a800000ULL,
+    0xe0352f62a19e306eULL, 0xd50b2037ad200000ULL,
+    0x8c213d9da502de45ULL, 0x4526f422cc340000ULL,
+    0xaf298d050e4395d6ULL, 0x9670b12b7f410000ULL,
+    0xdaf3f04651d47b4cULL, 0x3c0cdd765f114000ULL,
+    0x88d8762bf324cd0fULL, 0xa5880a69fb6ac800ULL,
+    0xab0e93b6efee0053ULL, 0x8eea0d047a457a00ULL,
+    0xd5d238a4abe98068ULL, 0x72a4904598d6d880ULL,
+    0x85a36366eb71f041ULL, 0x47a6da2b7f864750ULL,
+    0xa70c3c40a64e6c51ULL, 0x999090b65f67d924ULL,
+    0xd0cf4b50cfe20765ULL, 0xfff4b4e3f741cf6dULL,
+    0x82818f1281ed449fULL, 0xbff8f10e7a8921a4ULL,
+    0xa321f2d7226895c7ULL, 0xaff72d52192b6a0dULL,
+    0xcbea6f8ceb02bb39ULL, 0x9bf4f8a69f764490ULL,
+    0xfee50b7025c36a08ULL, 0x02f236d04753d5b4ULL,
+    0x9f4f2726179a2245ULL, 0x01d762422c946590ULL,
+    0xc722f0ef9d80aad6ULL, 0x424d3ad2b7b97ef5ULL,
+    0xf8ebad2b84e0d58bULL, 0xd2e0898765a7deb2ULL,
+    0x9b934c3b330c8577ULL, 0x63cc55f49f88eb2fULL,
+    0xc2781f49ffcfa6d5ULL, 0x3cbf6b71c76b25fbULL,
+    0xf316271c7fc3908aULL, 0x8bef464e3945ef7aULL,
+    0x97edd871cfda3a56ULL, 0x97758bf0e3cbb5acULL,
+    0xbde94e8e43d0c8ecULL, 0x3d52eeed1cbea317ULL,
+    0xed63a231d4c4fb27ULL, 0x4ca7aaa863ee4bddULL,
+    0x945e455f24fb1cf8ULL, 0x8fe8caa93e74ef6aULL,
+    0xb975d6b6ee39e436ULL, 0xb3e2fd538e122b44ULL,
+    0xe7d34c64a9c85d44ULL, 0x60dbbca87196b616ULL,
+    0x90e40fbeea1d3a4aULL, 0xbc8955e946fe31cdULL,
+    0xb51d13aea4a488ddULL, 0x6babab6398bdbe41ULL,
+    0xe264589a4dcdab14ULL, 0xc696963c7eed2dd1ULL,
+    0x8d7eb76070a08aecULL, 0xfc1e1de5cf543ca2ULL,
+    0xb0de65388cc8ada8ULL, 0x3b25a55f43294bcbULL,
+    0xdd15fe86affad912ULL, 0x49ef0eb713f39ebeULL,
+    0x8a2dbf142dfcc7abULL, 0x6e3569326c784337ULL,
+    0xacb92ed9397bf996ULL, 0x49c2c37f07965404ULL,
+    0xd7e77a8f87daf7fbULL, 0xdc33745ec97be906ULL,
+    0x86f0ac99b4e8dafdULL, 0x69a028bb3ded71a3ULL,
+    0xa8acd7c0222311bcULL, 0xc40832ea0d68ce0cULL,
+    0xd2d80db02aabd62bULL, 0xf50a3fa490c30190ULL,
+    0x83c7088e1aab65dbULL, 0x792667c6da79e0faULL,
+    0xa4b8cab1a1563f52ULL, 0x577001b891185938ULL,
+    0xcde6fd5e09abcf26ULL, 0xed4c0226b55e6f86ULL,
+    0x80b05e5ac60b6178ULL, 0x544f8158315b05b4ULL,
+    0xa0dc75f1778e39d6ULL, 0x696361ae3db1c721ULL,
+    0xc913936dd571c84cULL, 0x03bc3a19cd1e38e9ULL,
+    0xfb5878494ace3a5fULL, 0x04ab48a04065c723ULL,
+    0x9d174b2dcec0e47bULL, 0x62eb0d64283f9c76ULL,
+    0xc45d1df942711d9aULL, 0x3ba5d0bd324f8394ULL,
+    0xf5746577930d6500ULL, 0xca8f44ec7ee36479ULL,
+    0x9968bf6abbe85f20ULL, 0x7e998b13cf4e1ecbULL,
+    0xbfc2ef456ae276e8ULL, 0x9e3fedd8c321a67eULL,
+    0xefb3ab16c59b14a2ULL, 0xc5cfe94ef3ea101eULL,
+    0x95d04aee3b80ece5ULL, 0xbba1f1d158724a12ULL,
+    0xbb445da9ca61281fULL, 0x2a8a6e45ae8edc97ULL,
+    0xea1575143cf97226ULL, 0xf52d09d71a3293bdULL,
+    0x924d692ca61be758ULL, 0x593c2626705f9c56ULL,
+    0xb6e0c377cfa2e12eULL, 0x6f8b2fb00c77836cULL,
+    0xe498f455c38b997aULL, 0x0b6dfb9c0f956447ULL,
+    0x8edf98b59a373fecULL, 0x4724bd4189bd5eacULL,
+    0xb2977ee300c50fe7ULL, 0x58edec91ec2cb657ULL,
+    0xdf3d5e9bc0f653e1ULL, 0x2f2967b66737e3edULL,
+    0x8b865b215899f46cULL, 0xbd79e0d20082ee74ULL,
+    0xae67f1e9aec07187ULL, 0xecd8590680a3aa11ULL,
+    0xda01ee641a708de9ULL, 0xe80e6f4820cc9495ULL,
+    0x884134fe908658b2ULL, 0x3109058d147fdcddULL,
+    0xaa51823e34a7eedeULL, 0xbd4b46f0599fd415ULL,
+    0xd4e5e2cdc1d1ea96ULL, 0x6c9e18ac7007c91aULL,
+    0x850fadc09923329eULL, 0x03e2cf6bc604ddb0ULL,
+    0xa6539930bf6bff45ULL, 0x84db8346b786151cULL,
+    0xcfe87f7cef46ff16ULL, 0xe612641865679a63ULL,
+    0x81f14fae158c5f6eULL, 0x4fcb7e8f3f60c07eULL,
+    0xa26da3999aef7749ULL, 0xe3be5e330f38f09dULL,
+    0xcb090c8001ab551cULL, 0x5cadf5bfd3072cc5ULL,
+    0xfdcb4fa002162a63ULL, 0x73d9732fc7c8f7f6ULL,
+    0x9e9f11c4014dda7eULL, 0x2867e7fddcdd9afaULL,
+    0xc646d63501a1511dULL, 0xb281e1fd541501b8ULL,
+    0xf7d88bc24209a565ULL, 0x1f225a7ca91a4226ULL,
+    0x9ae757596946075fULL, 0x3375788de9b06958ULL,
+    0xc1a12d2fc3978937ULL, 0x0052d6b1641c83aeULL,
+    0xf209787bb47d6b84ULL, 0xc0678c5dbd23a49aULL,
+    0x9745eb4d50ce6332ULL, 0xf840b7ba963646e0ULL,
+    0xbd176620a501fbffULL, 0xb650e5a93bc3d898ULL,
+    0xec5d3fa8ce427affULL, 0xa3e51f138ab4cebeULL,
+    0x93ba47c980e98cdfULL, 0xc66f336c36b10137ULL,
+    0xb8a8d9bbe123f017ULL, 0xb80b0047445d4184ULL,
+    0xe6d3102ad96cec1dULL, 0xa60dc059157491e5ULL,
+    0x9043ea1ac7e41392ULL, 0x87c89837ad68db2fULL,
+    0xb454e4a179dd1877ULL, 0x29babe4598c311fbULL,
+    0xe16a1dc9d8545e94ULL, 0xf4296dd6fef3d67aULL,
+    0x8ce2529e2734bb1dULL, 0x1899e4a65f58660cULL,
+    0xb01ae745b101e9e4ULL, 0x5ec05dcff72e7f8fULL,
+    0xdc21a1171d42645dULL, 0x76707543f4fa1f73ULL,
+    0x899504ae72497ebaULL, 0x6a06494a791c53a8ULL,
+    0xabfa45da0edbde69ULL, 0x0487db9d17636892ULL,
+    0xd6f8d7509292d603ULL, 0x45a9d2845d3c42b6ULL,
+    0x865b86925b9bc5c2ULL, 0x0b8a2392ba45a9b2ULL,
+    0xa7f26836f282b732ULL, 0x8e6cac7768d7141eULL,
+    0xd1ef0244af2364ffULL, 0x3207d795430cd926ULL,
+    0x8335616aed761f1fULL, 0x7f44e6bd49e807b8ULL,
+    0xa402b9c5a8d3a6e7ULL, 0x5f16206c9c6209a6ULL,
+    0xcd036837130890a1ULL, 0x36dba887c37a8c0fULL,
+    0x802221226be55a64ULL, 0xc2494954da2c9789ULL,
+    0xa02aa96b06deb0fdULL, 0xf2db9baa10b7bd6cULL,
+    0xc83553c5c8965d3dULL, 0x6f92829494e5acc7ULL,
+    0xfa42a8b73abbf48cULL, 0xcb772339ba1f17f9ULL,
+    0x9c69a97284b578d7ULL, 0xff2a760414536efbULL,
+    0xc38413cf25e2d70dULL, 0xfef5138519684abaULL,
+    0xf46518c2ef5b8cd1ULL, 0x7eb258665fc25d69ULL,
+    0x98bf2f79d5993802ULL, 0xef2f773ffbd97a61ULL,
+    0xbeeefb584aff8603ULL, 0xaafb550ffacfd8faULL,
+    0xeeaaba2e5dbf6784ULL, 0x95ba2a53f983cf38ULL,
+    0x952ab45cfa97a0b2ULL, 0xdd945a747bf26183ULL,
+    0xba756174393d88dfULL, 0x94f971119aeef9e4ULL,
+    0xe912b9d1478ceb17ULL, 0x7a37cd5601aab85dULL,
+    0x91abb422ccb812eeULL, 0xac62e055c10ab33aULL,
+    0xb616a12b7fe617aaULL, 0x577b986b314d6009ULL,
+    0xe39c49765fdf9d94ULL, 0xed5a7e85fda0b80bULL,
+    0x8e41ade9fbebc27dULL, 0x14588f13be847307ULL,
+    0xb1d219647ae6b31cULL, 0x596eb2d8ae258fc8ULL,
+    0xde469fbd99a05fe3ULL, 0x6fca5f8ed9aef3bbULL,
+    0x8aec23d680043beeULL, 0x25de7bb9480d5854ULL,
+    0xada72ccc20054ae9ULL, 0xaf561aa79a10ae6aULL,
+    0xd910f7ff28069da4ULL, 0x1b2ba1518094da04ULL,
+    0x87aa9aff79042286ULL, 0x90fb44d2f05d0842ULL,
+    0xa99541bf57452b28ULL, 0x353a1607ac744a53ULL,
+    0xd3fa922f2d1675f2ULL, 0x42889b8997915ce8ULL,
+    0x847c9b5d7c2e09b7ULL, 0x69956135febada11ULL,
+    0xa59bc234db398c25ULL, 0x43fab9837e699095ULL,
+    0xcf02b2c21207ef2eULL, 0x94f967e45e03f4bbULL,
+    0x8161afb94b44f57dULL, 0x1d1be0eebac278f5ULL,
+    0xa1ba1ba79e1632dcULL, 0x6462d92a69731732ULL,
+    0xca28a291859bbf93ULL, 0x7d7b8f7503cfdcfeULL,
+    0xfcb2cb35e702af78ULL, 0x5cda735244c3d43eULL,
+    0x9defbf01b061adabULL, 0x3a0888136afa64a7ULL,
+    0xc56baec21c7a1916ULL, 0x088aaa1845b8fdd0ULL,
+    0xf6c69a72a3989f5bULL, 0x8aad549e57273d45ULL,
+    0x9a3c2087a63f6399ULL, 0x36ac54e2f678864bULL,
+    0xc0cb28a98fcf3c7fULL, 0x84576a1bb416a7ddULL,
+    0xf0fdf2d3f3c30b9fULL, 0x656d44a2a11c51d5ULL,
+    0x969eb7c47859e743ULL, 0x9f644ae5a4b1b325ULL,
+    0xbc4665b596706114ULL, 0x873d5d9f0dde1feeULL,
+    0xeb57ff22fc0c7959ULL, 0xa90cb506d155a7eaULL,
+    0x9316ff75dd87cbd8ULL, 0x09a7f12442d588f2ULL,
+    0xb7dcbf5354e9beceULL, 0x0c11ed6d538aeb2fULL,
+    0xe5d3ef282a242e81ULL, 0x8f1668c8a86da5faULL,
+    0x8fa475791a569d10ULL, 0xf96e017d694487bcULL,
+    0xb38d92d760ec4455ULL, 0x37c981dcc395a9acULL,
+    0xe070f78d3927556aULL, 0x85bbe253f47b1417ULL,
+    0x8c469ab843b89562ULL, 0x93956d7478ccec8eULL,
+    0xaf58416654a6babbULL, 0x387ac8d1970027b2ULL,
+    0xdb2e51bfe9d0696aULL, 0x06997b05fcc0319eULL,
+    0x88fcf317f22241e2ULL, 0x441fece3bdf81f03ULL,
+    0xab3c2fddeeaad25aULL, 0xd527e81cad7626c3ULL,
+    0xd60b3bd56a5586f1ULL, 0x8a71e223d8d3b074ULL,
+    0x85c7056562757456ULL, 0xf6872d5667844e49ULL,
+    0xa738c6bebb12d16cULL, 0xb428f8ac016561dbULL,
+    0xd106f86e69d785c7ULL, 0xe13336d701beba52ULL,
+    0x82a45b450226b39cULL, 0xecc0024661173473ULL,
+    0xa34d721642b06084ULL, 0x27f002d7f95d0190ULL,
+    0xcc20ce9bd35c78a5ULL, 0x31ec038df7b441f4ULL,
+    0xff290242c83396ceULL, 0x7e67047175a15271ULL,
+    0x9f79a169bd203e41ULL, 0x0f0062c6e984d386ULL,
+    0xc75809c42c684dd1ULL, 0x52c07b78a3e60868ULL,
+    0xf92e0c3537826145ULL, 0xa7709a56ccdf8a82ULL,
+    0x9bbcc7a142b17ccbULL, 0x88a66076400bb691ULL,
+    0xc2abf989935ddbfeULL, 0x6acff893d00ea435ULL,
+    0xf356f7ebf83552feULL, 0x0583f6b8c4124d43ULL,
+    0x98165af37b2153deULL, 0xc3727a337a8b704aULL,
+    0xbe1bf1b059e9a8d6ULL, 0x744f18c0592e4c5cULL,
+    0xeda2ee1c7064130cULL, 0x1162def06f79df73ULL,
+    0x9485d4d1c63e8be7ULL, 0x8addcb5645ac2ba8ULL,
+    0xb9a74a0637ce2ee1ULL, 0x6d953e2bd7173692ULL,
+    0xe8111c87c5c1ba99ULL, 0xc8fa8db6ccdd0437ULL,
+    0x910ab1d4db9914a0ULL, 0x1d9c9892400a22a2ULL,
+    0xb54d5e4a127f59c8ULL, 0x2503beb6d00cab4bULL,
+    0xe2a0b5dc971f303aULL, 0x2e44ae64840fd61dULL,
+    0x8da471a9de737e24ULL, 0x5ceaecfed289e5d2ULL,
+    0xb10d8e1456105dadULL, 0x7425a83e872c5f47ULL,
+    0xdd50f1996b947518ULL, 0xd12f124e28f77719ULL,
+    0x8a5296ffe33cc92fULL, 0x82bd6b70d99aaa6fULL,
+    0xace73cbfdc0bfb7bULL, 0x636cc64d1001550bULL,
+    0xd8210befd30efa5aULL, 0x3c47f7e05401aa4eULL,
+    0x8714a775e3e95c78ULL, 0x65acfaec34810a71ULL,
+    0xa8d9d1535ce3b396ULL, 0x7f1839a741a14d0dULL,
+    0xd31045a8341ca07cULL, 0x1ede48111209a050ULL,
+    0x83ea2b892091e44dULL, 0x934aed0aab460432ULL,
+    0xa4e4b66b68b65d60ULL, 0xf81da84d5617853fULL,
+    0xce1de40642e3f4b9ULL, 0x36251260ab9d668eULL,
+    0x80d2ae83e9ce78f3ULL, 0xc1d72b7c6b426019ULL,
+    0xa1075a24e4421730ULL, 0xb24cf65b8612f81fULL,
+    0xc94930ae1d529cfcULL, 0xdee033f26797b627ULL,
+    0xfb9b7cd9a4a7443cULL, 0x169840ef017da3b1ULL,
+    0x9d412e0806e88aa5ULL, 0x8e1f289560ee864eULL,
+    0xc491798a08a2ad4eULL, 0xf1a6f2bab92a27e2ULL,
+    0xf5b5d7ec8acb58a2ULL, 0xae10af696774b1dbULL,
+    0x9991a6f3d6bf1765ULL, 0xacca6da1e0a8ef29ULL,
+    0xbff610b0cc6edd3fULL, 0x17fd090a58d32af3ULL,
+    0xeff394dcff8a948eULL, 0xddfc4b4cef07f5b0ULL,
+    0x95f83d0a1fb69cd9ULL, 0x4abdaf101564f98eULL,
+    0xbb764c4ca7a4440fULL, 0x9d6d1ad41abe37f1ULL,
+    0xea53df5fd18d5513ULL, 0x84c86189216dc5edULL,
+    0x92746b9be2f8552cULL, 0x32fd3cf5b4e49bb4ULL,
+    0xb7118682dbb66a77ULL, 0x3fbc8c33221dc2a1ULL,
+    0xe4d5e82392a40515ULL, 0x0fabaf3feaa5334aULL,
+    0x8f05b1163ba6832dULL, 0x29cb4d87f2a7400eULL,
+    0xb2c71d5bca9023f8ULL, 0x743e20e9ef511012ULL,
+    0xdf78e4b2bd342cf6ULL, 0x914da9246b255416ULL,
+    0x8bab8eefb6409c1aULL, 0x1ad089b6c2f7548eULL,
+    0xae9672aba3d0c320ULL, 0xa184ac2473b529b1ULL,
+    0xda3c0f568cc4f3e8ULL, 0xc9e5d72d90a2741eULL,
+    0x8865899617fb1871ULL, 0x7e2fa67c7a658892ULL,
+    0xaa7eebfb9df9de8dULL, 0xddbb901b98feeab7ULL,
+    0xd51ea6fa85785631ULL, 0x552a74227f3ea565ULL,
+    0x8533285c936b35deULL, 0xd53a88958f87275fULL,
+    0xa67ff273b8460356ULL, 0x8a892abaf368f137ULL,
+    0xd01fef10a657842cULL, 0x2d2b7569b0432d85ULL,
+    0x8213f56a67f6b29bULL, 0x9c3b29620e29fc73ULL,
+    0xa298f2c501f45f42ULL, 0x8349f3ba91b47b8fULL,
+    0xcb3f2f7642717713ULL, 0x241c70a936219a73ULL,
+    0xfe0efb53d30dd4d7ULL, 0xed238cd383aa0110ULL,
+    0x9ec95d1463e8a506ULL, 0xf4363804324a40aaULL,
+    0xc67bb4597ce2ce48ULL, 0xb143c6053edcd0d5ULL,
+    0xf81aa16fdc1b81daULL, 0xdd94b7868e94050aULL,
+    0x9b10a4e5e9913128ULL, 0xca7cf2b4191c8326ULL,
+    0xc1d4ce1f63f57d72ULL, 0xfd1c2f611f63a3f0ULL,
+    0xf24a01a73cf2dccfULL, 0xbc633b39673c8cecULL,
+    0x976e41088617ca01ULL, 0xd5be0503e085d813ULL,
+    0xbd49d14aa79dbc82ULL, 0x4b2d8644d8a74e18ULL,
+    0xec9c459d51852ba2ULL, 0xddf8e7d60ed1219eULL,
+    0x93e1ab8252f33b45ULL, 0xcabb90e5c942b503ULL,
+    0xb8da1662e7b00a17ULL, 0x3d6a751f3b936243ULL,
+    0xe7109bfba19c0c9dULL, 0x0cc512670a783ad4ULL,
+    0x906a617d450187e2ULL, 0x27fb2b80668b24c5ULL,
+    0xb484f9dc9641e9daULL, 0xb1f9f660802dedf6ULL,
+    0xe1a63853bbd26451ULL, 0x5e7873f8a0396973ULL,
+    0x8d07e33455637eb2ULL, 0xdb0b487b6423e1e8ULL,
+    0xb049dc016abc5e5fULL, 0x91ce1a9a3d2cda62ULL,
+    0xdc5c5301c56b75f7ULL, 0x7641a140cc7810fbULL,
+    0x89b9b3e11b6329baULL, 0xa9e904c87fcb0a9dULL,
+    0xac2820d9623bf429ULL, 0x546345fa9fbdcd44ULL,
+    0xd732290fbacaf133ULL, 0xa97c177947ad4095ULL,
+    0x867f59a9d4bed6c0ULL, 0x49ed8eabcccc485dULL,
+    0xa81f301449ee8c70ULL, 0x5c68f256bfff5a74ULL,
+    0xd226fc195c6a2f8cULL, 0x73832eec6fff3111ULL,
+    0x83585d8fd9c25db7ULL, 0xc831fd53c5ff7eabULL,
+    0xa42e74f3d032f525ULL, 0xba3e7ca8b77f5e55ULL,
+    0xcd3a1230c43fb26fULL, 0x28ce1bd2e55f35ebULL,
+    0x80444b5e7aa7cf85ULL, 0x7980d163cf5b81b3ULL,
+    0xa0555e361951c366ULL, 0xd7e105bcc332621fULL,
+    0xc86ab5c39fa63440ULL, 0x8dd9472bf3fefaa7ULL,
+    0xfa856334878fc150ULL, 0xb14f98f6f0feb951ULL,
+    0x9c935e00d4b9d8d2ULL, 0x6ed1bf9a569f33d3ULL,
+    0xc3b8358109e84f07ULL, 0x0a862f80ec4700c8ULL,
+    0xf4a642e14c6262c8ULL, 0xcd27bb612758c0faULL,
+    0x98e7e9cccfbd7dbdULL, 0x8038d51cb897789cULL,
+    0xbf21e44003acdd2cULL, 0xe0470a63e6bd56c3ULL,
+    0xeeea5d5004981478ULL, 0x1858ccfce06cac74ULL,
+    0x95527a5202df0ccbULL, 0x0f37801e0c43ebc8ULL,
+    0xbaa718e68396cffdULL, 0xd30560258f54e6baULL,
+    0xe950df20247c83fdULL, 0x47c6b82ef32a2069ULL,
+    0x91d28b7416cdd27eULL, 0x4cdc331d57fa5441ULL,
+    0xb6472e511c81471dULL, 0xe0133fe4adf8e952ULL,
+    0xe3d8f9e563a198e5ULL, 0x58180fddd97723a6ULL,
+    0x8e679c2f5e44ff8fULL, 0x570f09eaa7ea7648ULL,
+};
+
+static const double cjson_exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool cjson_is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+/**
+ * @brief reads len digits into value, returns false if they overflow it
+ */
+static bool cjson_read_uint64(const char *digits, size_t len, uint64_t *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (__builtin_mul_overflow(*value, 10, value)
+                || __builtin_add_overflow(*value, digits[i] - '0', value))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief converts w * 10^q to the nearest double, returns false if it cannot
+ *        be decided without more precision
+ */
+static bool cjson_eisel_lemire(int64_t q, uint64_t w, bool negative, double *out)
+{
+    uint64_t bits;
+    if (w == 0 || q < CJSON_POW5_MIN_EXPONENT)
+    {
+        bits = 0;
+        goto done;
+    }
+    if (q > CJSON_POW5_MAX_EXPONENT)
+    {
+        bits = 0x7FFULL << 52;
+        goto done;
+    }
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    const uint64_t *power = &cjson_powers_of_five[2 * (q - CJSON_POW5_MIN_EXPONENT)];
+    uint64_t low = w;
+    uint64_t high = power[0];
+    cjson_mum(&low, &high);
+    // 55 bits of the product are kept: 52 explicit, the implicit one, the
+    // rounding bit and a possible leading zero
+    const uint64_t precision_mask = UINT64_MAX >> 55;
+    if ((high & precision_mask) == precision_mask)
+    {
+        uint64_t low2 = w;
+        uint64_t high2 = power[1];
+        cjson_mum(&low2, &high2);
+        low += high2;
+        if (high2 > low)
+            high += 1;
+        // 5^q only fits the table exactly for q in [-27, 55]
+        if (low == UINT64_MAX && (q < -27 || q > 55))
+            return false;
+    }
+
+    int upperbit = high >> 63;
+    int shift = upperbit + 64 - 52 - 3;
+    uint64_t mantissa = high >> shift;
+    int64_t power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+    if (power2 <= 0)
+    {
+        // Subnormal, possibly rounded up to the smallest normal
+        if (-power2 + 1 >= 64)
+        {
+            bits = 0;
+            goto done;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        power2 = mantissa < (1ULL << 52) ? 0 : 1;
+        bits = mantissa | ((uint64_t)power2 << 52);
+        goto done;
+    }
+    // Exactly halfway between two doubles: round to even
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+            && (mantissa << shift) == high)
+        mantissa &= ~1ULL;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52))
+    {
+        mantissa = 1ULL << 52;
+        power2 += 1;
+    }
+    mantissa &= ~(1ULL << 52);
+    if (power2 >= 0x7FF)
+        bits = 0x7FFULL << 52;
+    else
+        bits = mantissa | ((uint64_t)power2 << 52);
+
+done:
+    bits |= (uint64_t)negative << 63;
+    memcpy(out, &bits, sizeof(double));
+    return true;
+}
+
+/**
+ * @brief converts the len bytes of a number with strtod, which expects the
+ *        decimal point of the current locale
+ */
+static double cjson_strtod(const char *input, size_t len)
+{
+    char buffer[64];
+    char *copy = len < sizeof(buffer) ? buffer : malloc(len + 1);
+    memcpy(copy, input, len);
+    copy[len] = '\0';
+    char *point = memchr(copy, '.', len);
+    if (point != NULL)
+        *point = *localeconv()->decimal_point;
+    double res = strtod(copy, NULL);
+    if (copy != buffer)
+        free(copy);
+    return res;
+}
+
+/**
+ * @brief scans the number starting the avail bytes of input into token,
+ *        returns its length or 0 if it is not a valid number
+ */
+static size_t cjson_scan_number(const char *input, size_t avail, cjson_token *token)
+{
+    bool negative = input[0] == '-';
+    size_t i = negative;
+    size_t start = i;
+    uint64_t mantissa = 0;
+    if (i < avail && input[i] == '0')
+        i += 1;
+    else
+    {
+        while (i < avail && cjson_is_digit(input[i]))
+            mantissa = mantissa * 10 + (input[i++] - '0');
+    }
+    size_t digits = i - start;
+    if (digits == 0)
+        return 0;
+
+    size_t fraction_digits = 0;
+    if (i < avail && input[i] == '.')
+    {
+        i += 1;
+        size_t fraction = i;
+        while (i < avail && cjson_is_digit(input[i]))
+            mantissa = mantissa * 10 + (input[i++] - '0');
+        fraction_digits = i - fraction;
+        if (fraction_digits == 0)
+            return 0;
+        digits += fraction_digits;
+    }
+    size_t end = i;
+
+    int64_t exponent = 0;
+    bool has_exponent = i < avail && (input[i] == 'e' || input[i] == 'E');
+    if (has_exponent)
+    {
+        i += 1;
+        bool negative_exponent = i < avail && input[i] == '-';
+        if (i < avail && (input[i] == '-' || input[i] == '+'))
+            i += 1;
+        size_t exponent_start = i;
+        while (i < avail && cjson_is_digit(input[i]))
+        {
+            // Anything this large is already an infinity or a zero
+            if (exponent < 100000)
+                exponent = exponent * 10 + (input[i] - '0');
+            i += 1;
+        }
+        if (i == exponent_start)
+            return 0;
+        if (negative_exponent)
+            exponent = -exponent;
+    }
+
+    // Leading zeros are not significant, only look for them when it matters
+    if (digits > 19)
+    {
+        for (size_t j = start; j < end && (input[j] == '0' || input[j] == '.'); j++)
+            digits -= input[j] == '0';
+    }
+
+    if (fraction_digits == 0 && !has_exponent)
+    {
+        // Only the largest 20 digit values overflowed while scanning
+        bool fits = digits <= 19 || (digits == 20 && !negative
+                && cjson_read_uint64(input + start, digits, &mantissa));
+        if (fits && mantissa <= (uint64_t)INT64_MAX + negative)
+        {
+            token->type = CJSON_TOK_INTEGER;
+            token->integer_value = negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa;
+            return i;
+        }
+        if (fits && !negative)
+        {
+            token->type = CJSON_TOK_UNSIGNED;
+            token->unsigned_value = mantissa;
+            return i;
+        }
+    }
+
+    // Integers out of the 64-bit ranges end up here as well
+    token->type = CJSON_TOK_FLOAT;
+    if (digits <= 19)
+    {
+        int64_t q = exponent - (int64_t)fraction_digits;
+        if (mantissa <= (1ULL << 53) && q >= -22 && q <= 22)
+        {
+            // Both operands are exact doubles, so is the rounded result
+            double value = mantissa;
+            value = q < 0 ? value / cjson_exact_powers_of_ten[-q]
+                : value * cjson_exact_powers_of_ten[q];
+            token->float_value = negative ? -value : value;
+            return i;
+        }
+        if (cjson_eisel_lemire(q, mantissa, negative, &token->float_value))
+            return i;
+    }
+    token->float_value = cjson_strtod(input, i);
+    return i;
+}
+
+/**
+ * @brief whether the avail bytes of input are the start of keyword, cut
+ *        before its end
+ */
+static bool cjson_cut_keyword(const char *input, size_t avail, const char *keyword)
+{
+    return avail < strlen(keyword) && memcmp(input, keyword, avail) == 0;
+}
+
+/**
+ * @brief whether the avail bytes of input could all be part of one number
+ */
+static bool cjson_cut_number(const char *input, size_t avail)
+{
+    for (size_t i = 0; i < avail; i++)
+    {
+        if (!cjson_is_digit(input[i]) && strchr("+-.eE", input[i]) == NULL)
+            return false;
+    }
+    return true;
+}
+
+void cjson_read_next_token(cjson_lexer *lexer)
+{
+    // Every token starts on a structural character, whitespace is never seen
+    if (lexer->indexing)
+        lexer->location = cjson_lexer_next_structural(lexer);
+    else
+    {
+        while (lexer->location < lexer->size && isspace(lexer->content[lexer->location]))
+            lexer->location += 1;
+    }
+    const char *input = lexer->content + lexer->location;
+    // Nothing past these bytes is read, the content needs no terminator
+    size_t avail = lexer->size - lexer->location;
+    size_t token_len = 0;
+    switch (avail == 0 ? '\0' : input[0])
+    {
+    case '-':
+    case '0'...'9':
+        // The next chunk may hold more digits
+        if (lexer->partial && cjson_cut_number(input, avail))
+            goto token_partial;
+        token_len = cjson_scan_number(input, avail, &lexer->token);
+        if (token_len == 0)
+            goto token_error;
         break;
     case 'f':
-        if (strncmp(input, "false", 5) != 0)
+        if (avail < 5 || memcmp(input, "false", 5) != 0)
+        {
+            if (lexer->partial && cjson_cut_keyword(input, avail, "false"))
+                goto token_partial;
             goto token_error;
+        }
         token_len = 5;
         lexer->token.type = CJSON_TOK_FALSE;
         break;
     case 'n':
-        if (strncmp(input, "null", 4) != 0)
+        if (avail < 4 || memcmp(input, "null", 4) != 0)
+        {
+            if (lexer->partial && cjson_cut_keyword(input, avail, "null"))
+                goto token_partial;
             goto token_error;
+        }
         token_len = 4;
         lexer->token.type = CJSON_TOK_NULL;
         break;
     case 't':
-        if (strncmp(input, "true", 4) != 0)
+        if (avail < 4 || memcmp(input, "true", 4) != 0)
+        {
+            if (lexer->partial && cjson_cut_keyword(input, avail, "true"))
+                goto token_partial;
             goto token_error;
+        }
         token_len = 4;
         lexer->token.type = CJSON_TOK_TRUE;
         break;
@@ -470,741 +3242,3993 @@ void cjson_read_next_token(cjson_lexer *lexer)
         lexer->token.type = CJSON_TOK_COMMA;
         token_len = 1;
         break;
-    case ':':
-        lexer->token.type = CJSON_TOK_COLON;
-        token_len = 1;
+    case ':':
+        lexer->token.type = CJSON_TOK_COLON;
+        token_len = 1;
+        break;
+    case '[':
+        lexer->token.type = CJSON_TOK_LBRACK;
+        token_len = 1;
+        break;
+    case ']':
+        lexer->token.type = CJSON_TOK_RBRACK;
+        token_len = 1;
+        break;
+    case '{':
+        lexer->token.type = CJSON_TOK_LBRACE;
+        token_len = 1;
+        break;
+    case '}':
+        lexer->token.type = CJSON_TOK_RBRACE;
+        token_len = 1;
+        break;
+    case '"':
+        token_len = 1;
+        lexer->token.type = CJSON_TOK_STRING;
+        if (lexer->indexing)
+        {
+            // The closing quote is the next structural character
+            size_t end = cjson_lexer_next_structural(lexer);
+            if (end >= lexer->size || lexer->content[end] != '"')
+                goto token_error;
+            // Escapes are checked when the string is decoded
+            token_len = end - lexer->location + 1;
+            break;
+        }
+        while (true)
+        {
+            token_len += cjson_find_quote_or_backslash(input + token_len, avail - token_len);
+            if (token_len >= avail || input[token_len] == '"')
+                break;
+            if (token_len + 1 == avail && lexer->partial)
+                goto token_partial;
+            switch (token_len + 1 < avail ? input[token_len + 1] : '\0')
+            {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n':
+            case 'r': case 't':
+                token_len += 2;
+                break;
+            case 'u':
+            {
+                uint32_t code;
+                if (token_len + 6 > avail)
+                {
+                    if (lexer->partial)
+                        goto token_partial;
+                    goto token_error;
+                }
+                if (!cjson_read_hex4(input + token_len + 2, &code))
+                    goto token_error;
+                token_len += 6;
+                break;
+            }
+            default:
+                goto token_error;
+            }
+        }
+        if (token_len >= avail)
+        {
+            if (lexer->partial)
+                goto token_partial;
+            goto token_error;
+        }
+        token_len += 1;
+        break;
+    case '\0':
+        // Only the end of the content ends the input, a NUL byte within it is
+        // invalid
+        if (avail > 0)
+            goto token_error;
+        if (lexer->partial)
+            goto token_partial;
+        lexer->token.type = CJSON_TOK_EOF;
+        break;
+    default:
+token_error:
+        lexer->token.type = CJSON_TOK_ERROR;
+        break;
+token_partial:
+        // Read again from its start once the rest of the input is there
+        lexer->token.type = CJSON_TOK_PARTIAL;
+        token_len = 0;
+    }
+
+    // The index only holds the start of a number or keyword, reject anything
+    // glued to it that would otherwise be skipped
+    if (lexer->indexing && lexer->token.type >= CJSON_TOK_INTEGER
+            && lexer->token.type != CJSON_TOK_STRING && lexer->token.type <= CJSON_TOK_NULL
+            && token_len < avail && (input[token_len] == '\0'
+                || strchr(" \t\n\v\f\r,:[]{}\"", input[token_len]) == NULL))
+        lexer->token.type = CJSON_TOK_ERROR;
+
+    // Strings are decoded over their token when parsing in situ, which is
+    // only done over writable content
+    lexer->token.content = (char *)input;
+    lexer->token.content_len = token_len;
+    lexer->location += token_len;
+}
+
+cjson_token cjson_lexer_peek(cjson_lexer *lexer)
+{
+    if (lexer->token.type == CJSON_TOK_NONE)
+        cjson_read_next_token(lexer);
+    return lexer->token;
+}
+
+cjson_token cjson_lexer_pop(cjson_lexer *lexer)
+{
+    if (lexer->token.type == CJSON_TOK_NONE)
+        cjson_read_next_token(lexer);
+    cjson_token res = lexer->token;
+    lexer->token.type = CJSON_TOK_NONE;
+    return res;
+}
+
+/**
+ * @brief enters an object if in_object is true, an array otherwise. returns
+ *        false if that goes deeper than max_depth
+ */
+static bool cjson_lexer_open(cjson_lexer *lexer, bool in_object)
+{
+    if (lexer->depth >= lexer->max_depth)
+        return false;
+    if (lexer->depth == lexer->nesting_capacity)
+    {
+        lexer->nesting_capacity = lexer->nesting_capacity == 0 ? 64 : lexer->nesting_capacity * 2;
+        lexer->nesting = realloc(lexer->nesting, lexer->nesting_capacity * sizeof(bool));
+    }
+    lexer->nesting[lexer->depth++] = in_object;
+    return true;
+}
+
+// What cjson_lexer_parse stopped on
+enum
+{
+    CJSON_PARSE_ERROR = -1,
+    CJSON_PARSE_DONE,
+    CJSON_PARSE_PARTIAL,
+    // a callback returned false
+    CJSON_PARSE_STOPPED,
+};
+
+// Calls the event callback of the handler unless it is NULL. If it returns
+// false, cjson_lexer_parse stops to resume from resume_state
+#define CJSON_EMIT(resume_state, event, ...) \
+    do \
+    { \
+        if (handler->event != NULL && !handler->event(ctx, ##__VA_ARGS__)) \
+        { \
+            lexer->resume = (resume_state); \
+            return CJSON_PARSE_STOPPED; \
+        } \
+    } while (0)
+
+/**
+ * @brief parses a value without recursing, giving its events to handler:
+ *        open containers are kept on the lexer nesting stack, which may not
+ *        grow deeper than max_depth
+ *
+ * Returns CJSON_PARSE_ERROR if the value is invalid. On partial content,
+ * CJSON_PARSE_PARTIAL is returned when a token is cut by its end and the next
+ * call, given the rest of the input, resumes from there. Likewise, the next
+ * call resumes after the event whose callback returned CJSON_PARSE_STOPPED.
+ */
+static inline __attribute__((always_inline)) int cjson_lexer_parse(cjson_lexer *lexer,
+        const cjson_handler *handler, void *ctx)
+{
+    cjson_token token;
+    bool in_object;
+    char *str;
+    size_t len;
+
+    switch (lexer->resume)
+    {
+    case CJSON_RESUME_OBJECT_START:
+        goto object_start;
+    case CJSON_RESUME_ARRAY_START:
+        goto array_start;
+    case CJSON_RESUME_NEXT:
+        goto next;
+    case CJSON_RESUME_KEY:
+        goto parse_key;
+    case CJSON_RESUME_COLON:
+        goto colon;
+    case CJSON_RESUME_VALUE_DONE:
+        goto value_done;
+    }
+
+parse_value:
+    token = cjson_lexer_pop(lexer);
+    switch (token.type)
+    {
+    case CJSON_TOK_LBRACE:
+        if (!cjson_lexer_open(lexer, true))
+            goto fail;
+        CJSON_EMIT(CJSON_RESUME_OBJECT_START, start_object);
+        goto object_start;
+    case CJSON_TOK_LBRACK:
+        if (!cjson_lexer_open(lexer, false))
+            goto fail;
+        CJSON_EMIT(CJSON_RESUME_ARRAY_START, start_array);
+        goto array_start;
+    case CJSON_TOK_STRING:
+        str = cjson_lexer_string(lexer, &token, &len);
+        if (str == NULL)
+            goto fail;
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, string, str, len);
+        break;
+    case CJSON_TOK_INTEGER:
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, integer, token.integer_value);
         break;
-    case '[':
-        lexer->token.type = CJSON_TOK_LBRACK;
-        token_len = 1;
+    case CJSON_TOK_UNSIGNED:
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, unsigned_integer, token.unsigned_value);
         break;
-    case ']':
-        lexer->token.type = CJSON_TOK_RBRACK;
-        token_len = 1;
+    case CJSON_TOK_FLOAT:
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, fraction, token.float_value);
         break;
-    case '{':
-        lexer->token.type = CJSON_TOK_LBRACE;
-        token_len = 1;
+    case CJSON_TOK_TRUE:
+    case CJSON_TOK_FALSE:
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, boolean, token.type == CJSON_TOK_TRUE);
         break;
-    case '}':
-        lexer->token.type = CJSON_TOK_RBRACE;
-        token_len = 1;
+    case CJSON_TOK_NULL:
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, null);
         break;
-    case '"':
-        token_len = 1;
-        lexer->token.type = CJSON_TOK_STRING;
-        while (input[token_len] != '"')
+    case CJSON_TOK_PARTIAL:
+        lexer->resume = CJSON_RESUME_VALUE;
+        return CJSON_PARSE_PARTIAL;
+    default:
+        goto fail;
+    }
+
+value_done:
+    if (lexer->depth == 0)
+    {
+        // Only whitespace may follow the value. More of it may come in the
+        // next chunk of a partial content, which its caller checks
+        if (!lexer->partial && cjson_lexer_peek(lexer).type != CJSON_TOK_EOF)
+            goto fail;
+        return CJSON_PARSE_DONE;
+    }
+
+next:
+    token = cjson_lexer_pop(lexer);
+    in_object = lexer->nesting[lexer->depth - 1];
+    if (token.type == CJSON_TOK_COMMA)
+    {
+        if (in_object)
+            goto parse_key;
+        goto parse_value;
+    }
+    if (token.type == CJSON_TOK_PARTIAL)
+    {
+        lexer->resume = CJSON_RESUME_NEXT;
+        return CJSON_PARSE_PARTIAL;
+    }
+    if (token.type != (in_object ? CJSON_TOK_RBRACE : CJSON_TOK_RBRACK))
+        goto fail;
+
+close:
+    if (lexer->nesting[--lexer->depth])
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, end_object);
+    else
+        CJSON_EMIT(CJSON_RESUME_VALUE_DONE, end_array);
+    goto value_done;
+
+object_start:
+    token = cjson_lexer_peek(lexer);
+    if (token.type == CJSON_TOK_PARTIAL)
+    {
+        lexer->resume = CJSON_RESUME_OBJECT_START;
+        return CJSON_PARSE_PARTIAL;
+    }
+    if (token.type != CJSON_TOK_RBRACE)
+        goto parse_key;
+    cjson_lexer_pop(lexer);
+    goto close;
+
+array_start:
+    token = cjson_lexer_peek(lexer);
+    if (token.type == CJSON_TOK_PARTIAL)
+    {
+        lexer->resume = CJSON_RESUME_ARRAY_START;
+        return CJSON_PARSE_PARTIAL;
+    }
+    if (token.type != CJSON_TOK_RBRACK)
+        goto parse_value;
+    cjson_lexer_pop(lexer);
+    goto close;
+
+parse_key:
+    token = cjson_lexer_pop(lexer);
+    if (token.type != CJSON_TOK_STRING)
+    {
+        if (token.type == CJSON_TOK_PARTIAL)
+        {
+            lexer->resume = CJSON_RESUME_KEY;
+            return CJSON_PARSE_PARTIAL;
+        }
+        goto fail;
+    }
+    // Given before the colon is read, which may be in another chunk
+    str = cjson_lexer_string(lexer, &token, &len);
+    if (str == NULL)
+        goto fail;
+    CJSON_EMIT(CJSON_RESUME_COLON, key, str, len);
+
+colon:
+    token = cjson_lexer_pop(lexer);
+    if (token.type == CJSON_TOK_COLON)
+        goto parse_value;
+    if (token.type == CJSON_TOK_PARTIAL)
+    {
+        lexer->resume = CJSON_RESUME_COLON;
+        return CJSON_PARSE_PARTIAL;
+    }
+
+fail:
+    return CJSON_PARSE_ERROR;
+}
+
+#undef CJSON_EMIT
+
+/*
+ * Array or object being built. Its children are gathered on the builder stacks
+ * from first on and only attached to it once it is closed.
+ */
+typedef struct
+{
+    cjson_element *element;
+    size_t first;
+} cjson_dom_frame;
+
+/*
+ * Consumer of the parse events building the elements: the parsers are this
+ * consumer driven by cjson_lexer_parse.
+ */
+typedef struct
+{
+    // where the elements are allocated, NULL for the heap
+    cjson_arena *arena;
+    // strings and keys are given decoded in situ and are kept where they are
+    bool insitu;
+    // elements of the arrays being built, waiting to be moved to their array
+    cjson_element **values;
+    size_t values_size;
+    size_t values_capacity;
+    // members of the objects being built, waiting to be moved to their map
+    cjson_map_item *members;
+    size_t members_size;
+    size_t members_capacity;
+    // containers being built, from the outermost
+    cjson_dom_frame *frames;
+    size_t frames_size;
+    size_t frames_capacity;
+    // set once the outermost value is complete
+    cjson_element *root;
+} cjson_dom_builder;
+
+static void cjson_dom_init(cjson_dom_builder *dom, cjson_arena *arena, bool insitu)
+{
+    memset(dom, 0, sizeof(cjson_dom_builder));
+    dom->arena = arena;
+    dom->insitu = insitu;
+}
+
+static void cjson_dom_push_value(cjson_dom_builder *dom, cjson_element *element)
+{
+    if (dom->values_size == dom->values_capacity)
+    {
+        dom->values_capacity = dom->values_capacity == 0 ? 64 : dom->values_capacity * 2;
+        dom->values = realloc(dom->values, dom->values_capacity * sizeof(cjson_element *));
+    }
+    dom->values[dom->values_size++] = element;
+}
+
+/**
+ * @brief pushes a member whose value is not parsed yet
+ */
+static void cjson_dom_push_member(cjson_dom_builder *dom, char *name, size_t hash)
+{
+    if (dom->members_size == dom->members_capacity)
+    {
+        dom->members_capacity = dom->members_capacity == 0 ? 64 : dom->members_capacity * 2;
+        dom->members = realloc(dom->members, dom->members_capacity * sizeof(cjson_map_item));
+    }
+    cjson_map_item *member = &dom->members[dom->members_size++];
+    member->name = name;
+    member->element = NULL;
+    member->hash = hash;
+}
+
+static void cjson_dom_push_frame(cjson_dom_builder *dom, cjson_element *element,
+        size_t first)
+{
+    if (dom->frames_size == dom->frames_capacity)
+    {
+        dom->frames_capacity = dom->frames_capacity == 0 ? 16 : dom->frames_capacity * 2;
+        dom->frames = realloc(dom->frames, dom->frames_capacity * sizeof(cjson_dom_frame));
+    }
+    cjson_dom_frame *frame = &dom->frames[dom->frames_size++];
+    frame->element = element;
+    frame->first = first;
+}
+
+/**
+ * @brief moves the members gathered from first on into the map of object,
+ *        which is sized only once
+ */
+static void cjson_close_object(cjson_dom_builder *dom, cjson_element *object, size_t first)
+{
+    cjson_map *map = &object->value.object.members;
+    cjson_map_reserve(map, dom->arena, dom->members_size - first);
+    for (size_t i = first; i < dom->members_size; i++)
+    {
+        cjson_map_item *member = &dom->members[i];
+        cjson_map_item *item = cjson_map_find(map, member->name, member->hash);
+        if (item == NULL)
+            cjson_map_append(map, *member);
+        else
+        {
+            // The last duplicate member wins
+            if (dom->arena == NULL)
+            {
+                free(member->name);
+                cjson_delete(item->element);
+            }
+            item->element = member->element;
+        }
+    }
+    dom->members_size = first;
+}
+
+/**
+ * @brief moves the elements gathered from first on into array, which is
+ *        allocated only once
+ */
+static void cjson_close_array(cjson_dom_builder *dom, cjson_element *array, size_t first)
+{
+    size_t size = dom->values_size - first;
+    if (size > 0)
+    {
+        cjson_array *res = &array->value.array;
+        res->elements = dom->arena == NULL
+            ? malloc(size * sizeof(cjson_element *))
+            : cjson_arena_alloc(dom->arena, size * sizeof(cjson_element *));
+        memcpy(res->elements, dom->values + first, size * sizeof(cjson_element *));
+        res->size = size;
+        res->capacity = size;
+    }
+    dom->values_size = first;
+}
+
+/**
+ * @brief gives a complete value to the innermost container, or makes it the
+ *        root when there is none
+ */
+static bool cjson_dom_attach(cjson_dom_builder *dom, cjson_element *value)
+{
+    if (dom->frames_size == 0)
+        dom->root = value;
+    else if (dom->frames[dom->frames_size - 1].element->element_type == CJSON_OBJECT)
+        dom->members[dom->members_size - 1].element = value;
+    else
+        cjson_dom_push_value(dom, value);
+    return true;
+}
+
+static bool cjson_dom_null(void *ctx)
+{
+    cjson_dom_builder *dom = ctx;
+    return cjson_dom_attach(dom, cjson_new_element(dom->arena, CJSON_NULL));
+}
+
+static bool cjson_dom_boolean(void *ctx, bool value)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_element *element = cjson_new_element(dom->arena, CJSON_BOOL);
+    element->value.boolean.value = value;
+    return cjson_dom_attach(dom, element);
+}
+
+static bool cjson_dom_integer(void *ctx, int64_t value)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_element *element = cjson_new_element(dom->arena, CJSON_INTEGER);
+    element->value.integer.value = value;
+    return cjson_dom_attach(dom, element);
+}
+
+static bool cjson_dom_unsigned_integer(void *ctx, uint64_t value)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_element *element = cjson_new_element(dom->arena, CJSON_UNSIGNED);
+    element->value.unsigned_integer.value = value;
+    return cjson_dom_attach(dom, element);
+}
+
+static bool cjson_dom_fraction(void *ctx, double value)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_element *element = cjson_new_element(dom->arena, CJSON_FLOAT);
+    element->value.fraction.value = value;
+    return cjson_dom_attach(dom, element);
+}
+
+static bool cjson_dom_string(void *ctx, const char *str, size_t len)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_element *element = cjson_new_element(dom->arena, CJSON_STRING);
+    element->value.string.value = dom->insitu ? (char *)str : cjson_strndup(dom->arena, str, len);
+    return cjson_dom_attach(dom, element);
+}
+
+static bool cjson_dom_start_object(void *ctx)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_dom_push_frame(dom, cjson_new_element(dom->arena, CJSON_OBJECT), dom->members_size);
+    return true;
+}
+
+static bool cjson_dom_key(void *ctx, const char *str, size_t len)
+{
+    cjson_dom_builder *dom = ctx;
+    char *name = dom->insitu ? (char *)str : cjson_strndup(dom->arena, str, len);
+    // Hashed while its length is known, the map never hashes it again
+    cjson_dom_push_member(dom, name, cjson_hash(name, len));
+    return true;
+}
+
+static bool cjson_dom_end_object(void *ctx)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_dom_frame *frame = &dom->frames[--dom->frames_size];
+    cjson_close_object(dom, frame->element, frame->first);
+    return cjson_dom_attach(dom, frame->element);
+}
+
+static bool cjson_dom_start_array(void *ctx)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_dom_push_frame(dom, cjson_new_element(dom->arena, CJSON_ARRAY), dom->values_size);
+    return true;
+}
+
+static bool cjson_dom_end_array(void *ctx)
+{
+    cjson_dom_builder *dom = ctx;
+    cjson_dom_frame *frame = &dom->frames[--dom->frames_size];
+    cjson_close_array(dom, frame->element, frame->first);
+    return cjson_dom_attach(dom, frame->element);
+}
+
+static const cjson_handler cjson_dom_handler = {
+    .null = cjson_dom_null,
+    .boolean = cjson_dom_boolean,
+    .integer = cjson_dom_integer,
+    .unsigned_integer = cjson_dom_unsigned_integer,
+    .fraction = cjson_dom_fraction,
+    .string = cjson_dom_string,
+    .start_object = cjson_dom_start_object,
+    .key = cjson_dom_key,
+    .end_object = cjson_dom_end_object,
+    .start_array = cjson_dom_start_array,
+    .end_array = cjson_dom_end_array,
+};
+
+/**
+ * @brief frees the builder stacks, with the elements left on them when a parse
+ *        failed. the root is kept
+ */
+static void cjson_dom_release(cjson_dom_builder *dom)
+{
+    if (dom->arena == NULL)
+    {
+        for (size_t i = 0; i < dom->values_size; i++)
+            cjson_delete(dom->values[i]);
+        for (size_t i = 0; i < dom->members_size; i++)
+        {
+            free(dom->members[i].name);
+            cjson_delete(dom->members[i].element);
+        }
+        // Open containers have nothing attached to them yet
+        for (size_t i = 0; i < dom->frames_size; i++)
+            free(dom->frames[i].element);
+    }
+    free(dom->values);
+    free(dom->members);
+    free(dom->frames);
+}
+
+static const cjson_parse_options cjson_default_parse_options = {
+    .padding = 0,
+    .max_depth = CJSON_DEFAULT_MAX_DEPTH,
+    .validate_utf8 = false,
+};
+
+/**
+ * @brief applies the options that do not depend on how the content is given
+ */
+static void cjson_lexer_options(cjson_lexer *lexer, const cjson_parse_options *options)
+{
+    lexer->max_depth = options->max_depth == 0 ? CJSON_DEFAULT_MAX_DEPTH
+        : options->max_depth;
+    lexer->validate_utf8 = options->validate_utf8;
+}
+
+/**
+ * @brief parses size bytes of str, allocating the elements from arena or from
+ *        the heap if arena is NULL, and decoding strings inside str if insitu.
+ *        returns NULL if it fails
+ */
+static cjson_element *cjson_parse_in(cjson_arena *arena, const char *str, size_t size,
+        bool insitu, const cjson_parse_options *options)
+{
+    cjson_lexer lexer;
+    cjson_lexer_init(&lexer, str, size, true);
+    cjson_lexer_options(&lexer, options);
+    lexer.padding = options->padding;
+    lexer.insitu = insitu;
+    cjson_dom_builder dom;
+    cjson_dom_init(&dom, arena, insitu);
+    if (cjson_lexer_parse(&lexer, &cjson_dom_handler, &dom) != CJSON_PARSE_DONE)
+    {
+        // The root is complete when what follows it is invalid
+        if (arena == NULL)
+            cjson_delete(dom.root);
+        dom.root = NULL;
+    }
+    cjson_dom_release(&dom);
+    cjson_lexer_release(&lexer);
+    return dom.root;
+}
+
+cjson_element *cjson_parse_str(char *str)
+{
+    return cjson_parse_n(str, strlen(str), NULL);
+};
+
+cjson_element *cjson_parse_n(const char *buf, size_t len,
+        const cjson_parse_options *options)
+{
+    if (options == NULL)
+        options = &cjson_default_parse_options;
+    return cjson_parse_in(NULL, buf, len, false, options);
+}
+
+int cjson_parse_events(const char *buf, size_t len, const cjson_handler *handler,
+        void *ctx, const cjson_parse_options *options)
+{
+    if (options == NULL)
+        options = &cjson_default_parse_options;
+    cjson_lexer lexer;
+    cjson_lexer_init(&lexer, buf, len, true);
+    cjson_lexer_options(&lexer, options);
+    lexer.padding = options->padding;
+    int res = cjson_lexer_parse(&lexer, handler, ctx) == CJSON_PARSE_DONE ? 0 : -1;
+    cjson_lexer_release(&lexer);
+    return res;
+}
+
+static cjson_document *cjson_parse_document_in(char *str, size_t size, bool insitu)
+{
+    cjson_document *document = calloc(1, sizeof(cjson_document));
+    document->root = cjson_parse_in(&document->arena, str, size, insitu,
+            &cjson_default_parse_options);
+    if (document->root == NULL)
+    {
+        cjson_document_delete(document);
+        return NULL;
+    }
+    return document;
+}
+
+cjson_document *cjson_parse_document(char *str)
+{
+    return cjson_parse_document_in(str, strlen(str), false);
+}
+
+cjson_document *cjson_parse_insitu(char *buf, size_t len)
+{
+    return cjson_parse_document_in(buf, len, true);
+}
+
+cjson_element *cjson_document_root(cjson_document *document)
+{
+    return document->root;
+}
+
+void cjson_document_delete(cjson_document *document)
+{
+    if (document == NULL)
+        return;
+    cjson_arena_release(&document->arena);
+    free(document);
+}
+
+struct cjson_parser
+{
+    cjson_lexer lexer;
+    cjson_dom_builder dom;
+    // start of the token cut by the end of the last chunk
+    cjson_str_builder pending;
+    bool failed;
+};
+
+cjson_parser *cjson_parser_new(const cjson_parse_options *options)
+{
+    if (options == NULL)
+        options = &cjson_default_parse_options;
+    cjson_parser *parser = calloc(1, sizeof(cjson_parser));
+    // Chunks are lexed byte by byte, the index does not span them
+    cjson_lexer_init(&parser->lexer, NULL, 0, false);
+    cjson_lexer_options(&parser->lexer, options);
+    cjson_dom_init(&parser->dom, NULL, false);
+    return parser;
+}
+
+/**
+ * @brief parses as much of the size bytes of content as possible, the lexer is
+ *        left on the start of the token cut by their end if partial is true
+ */
+static void cjson_parser_run(cjson_parser *parser, const char *content, size_t size,
+        bool partial)
+{
+    cjson_lexer *lexer = &parser->lexer;
+    lexer->content = content;
+    lexer->size = size;
+    lexer->location = 0;
+    lexer->partial = partial;
+    lexer->token.type = CJSON_TOK_NONE;
+    if (parser->dom.root == NULL)
+    {
+        int status = cjson_lexer_parse(lexer, &cjson_dom_handler, &parser->dom);
+        parser->failed = status == CJSON_PARSE_ERROR;
+        if (status != CJSON_PARSE_DONE)
+            return;
+    }
+    // Only whitespace may follow the value
+    int type = cjson_lexer_peek(lexer).type;
+    if (type != CJSON_TOK_EOF && type != CJSON_TOK_PARTIAL)
+        parser->failed = true;
+}
+
+/**
+ * @brief returns how many bytes of input belong to the token whose first cut
+ *        bytes are in start, len if it may go on past them
+ */
+static size_t cjson_token_rest(const char *start, size_t cut, const char *input, size_t len)
+{
+    if (start[0] != '"')
+    {
+        // Numbers and keywords end on the first byte that cannot be in one
+        size_t i = 0;
+        while (i < len && (isalnum(input[i]) || strchr("+-.", input[i]) != NULL))
+            i++;
+        return i;
+    }
+    // The cut may fall right after a backslash, then the first byte of input
+    // is escaped
+    size_t backslashes = 0;
+    while (backslashes + 1 < cut && start[cut - 1 - backslashes] == '\\')
+        backslashes++;
+    size_t i = backslashes % 2;
+    while (i < len)
+    {
+        i += cjson_find_quote_or_backslash(input + i, len - i);
+        if (i >= len)
+            break;
+        if (input[i] == '"')
+            return i + 1;
+        i += 2;
+    }
+    return len;
+}
+
+int cjson_parser_feed(cjson_parser *parser, const char *chunk, size_t len)
+{
+    cjson_lexer *lexer = &parser->lexer;
+    cjson_str_builder *pending = &parser->pending;
+    const char *input = chunk;
+    size_t offset = 0;
+    if (parser->failed)
+        return -1;
+
+    if (pending->size > 0)
+    {
+        // Complete the cut token, with the byte after it when there is one so
+        // that a number or keyword is known to end
+        size_t cut = pending->size;
+        size_t rest = cjson_token_rest(pending->str, cut, input, len);
+        size_t take = rest < len ? rest + 1 : len;
+        cjson_str_builder_append(pending, input, take);
+        cjson_parser_run(parser, pending->str, pending->size, true);
+        if (lexer->location < cut)
+        {
+            // Still cut, the whole chunk went into it unless it is invalid
+            if (take < len)
+                parser->failed = true;
+            return parser->failed ? -1 : 0;
+        }
+        // Bytes past the token are parsed again from the chunk itself
+        offset = lexer->location - cut;
+        pending->size = 0;
+        if (parser->failed)
+            return -1;
+    }
+
+    cjson_parser_run(parser, input + offset, len - offset, true);
+    if (parser->failed)
+        return -1;
+    offset += lexer->location;
+    cjson_str_builder_append(pending, input + offset, len - offset);
+    return 0;
+}
+
+cjson_element *cjson_parser_finish(cjson_parser *parser)
+{
+    if (!parser->failed)
+    {
+        const char *content = parser->pending.size > 0 ? parser->pending.str : "";
+        cjson_parser_run(parser, content, parser->pending.size, false);
+    }
+    cjson_element *res = NULL;
+    if (!parser->failed)
+    {
+        res = parser->dom.root;
+        parser->dom.root = NULL;
+    }
+    cjson_parser_delete(parser);
+    return res;
+}
+
+void cjson_parser_delete(cjson_parser *parser)
+{
+    if (parser == NULL)
+        return;
+    cjson_dom_release(&parser->dom);
+    cjson_delete(parser->dom.root);
+    cjson_lexer_release(&parser->lexer);
+    free(parser->pending.str);
+    free(parser);
+}
+
+
+struct cjson_reader
+{
+    cjson_lexer lexer;
+    // type of the last event and its value
+    int event;
+    union
+    {
+        bool boolean;
+        int64_t integer;
+        uint64_t unsigned_integer;
+        double fraction;
+    } value;
+    const char *str;
+    size_t len;
+};
+
+/*
+ * Every callback of the reader records its event and stops cjson_lexer_parse,
+ * which cjson_reader_next resumes for the following one.
+ */
+
+static bool cjson_reader_event(void *ctx, int event)
+{
+    ((cjson_reader *)ctx)->event = event;
+    return false;
+}
+
+static bool cjson_reader_null(void *ctx)
+{
+    return cjson_reader_event(ctx, CJSON_READ_NULL);
+}
+
+static bool cjson_reader_boolean(void *ctx, bool value)
+{
+    ((cjson_reader *)ctx)->value.boolean = value;
+    return cjson_reader_event(ctx, CJSON_READ_BOOL);
+}
+
+static bool cjson_reader_integer(void *ctx, int64_t value)
+{
+    ((cjson_reader *)ctx)->value.integer = value;
+    return cjson_reader_event(ctx, CJSON_READ_INTEGER);
+}
+
+static bool cjson_reader_unsigned_integer(void *ctx, uint64_t value)
+{
+    ((cjson_reader *)ctx)->value.unsigned_integer = value;
+    return cjson_reader_event(ctx, CJSON_READ_UNSIGNED);
+}
+
+static bool cjson_reader_fraction(void *ctx, double value)
+{
+    ((cjson_reader *)ctx)->value.fraction = value;
+    return cjson_reader_event(ctx, CJSON_READ_FLOAT);
+}
+
+static bool cjson_reader_string(void *ctx, const char *str, size_t len)
+{
+    cjson_reader *reader = ctx;
+    reader->str = str;
+    reader->len = len;
+    return cjson_reader_event(ctx, CJSON_READ_STRING);
+}
+
+static bool cjson_reader_start_object(void *ctx)
+{
+    return cjson_reader_event(ctx, CJSON_READ_START_OBJECT);
+}
+
+static bool cjson_reader_key(void *ctx, const char *str, size_t len)
+{
+    cjson_reader *reader = ctx;
+    reader->str = str;
+    reader->len = len;
+    return cjson_reader_event(ctx, CJSON_READ_KEY);
+}
+
+static bool cjson_reader_end_object(void *ctx)
+{
+    return cjson_reader_event(ctx, CJSON_READ_END_OBJECT);
+}
+
+static bool cjson_reader_start_array(void *ctx)
+{
+    return cjson_reader_event(ctx, CJSON_READ_START_ARRAY);
+}
+
+static bool cjson_reader_end_array(void *ctx)
+{
+    return cjson_reader_event(ctx, CJSON_READ_END_ARRAY);
+}
+
+static const cjson_handler cjson_reader_handler = {
+    .null = cjson_reader_null,
+    .boolean = cjson_reader_boolean,
+    .integer = cjson_reader_integer,
+    .unsigned_integer = cjson_reader_unsigned_integer,
+    .fraction = cjson_reader_fraction,
+    .string = cjson_reader_string,
+    .start_object = cjson_reader_start_object,
+    .key = cjson_reader_key,
+    .end_object = cjson_reader_end_object,
+    .start_array = cjson_reader_start_array,
+    .end_array = cjson_reader_end_array,
+};
+
+cjson_reader *cjson_reader_new(const char *buf, size_t len,
+        const cjson_parse_options *options)
+{
+    if (options == NULL)
+        options = &cjson_default_parse_options;
+    cjson_reader *reader = malloc(sizeof(cjson_reader));
+    cjson_lexer_init(&reader->lexer, buf, len, true);
+    cjson_lexer_options(&reader->lexer, options);
+    reader->lexer.padding = options->padding;
+    reader->event = CJSON_READ_END;
+    return reader;
+}
+
+int cjson_reader_next(cjson_reader *reader)
+{
+    // The lexer state is undefined past an error
+    if (reader->event == CJSON_READ_ERROR)
+        return CJSON_READ_ERROR;
+    int status = cjson_lexer_parse(&reader->lexer, &cjson_reader_handler, reader);
+    if (status == CJSON_PARSE_DONE)
+        reader->event = CJSON_READ_END;
+    else if (status == CJSON_PARSE_ERROR)
+        reader->event = CJSON_READ_ERROR;
+    return reader->event;
+}
+
+int cjson_reader_skip_value(cjson_reader *reader)
+{
+    if (reader->event == CJSON_READ_KEY)
+        cjson_reader_next(reader);
+    if (reader->event == CJSON_READ_START_OBJECT || reader->event == CJSON_READ_START_ARRAY)
+    {
+        if (!cjson_lexer_skip_container(&reader->lexer))
+            reader->event = CJSON_READ_ERROR;
+        else if (reader->event == CJSON_READ_START_OBJECT)
+            reader->event = CJSON_READ_END_OBJECT;
+        else
+            reader->event = CJSON_READ_END_ARRAY;
+    }
+    return reader->event == CJSON_READ_ERROR ? -1 : 0;
+}
+
+bool cjson_reader_get_bool(cjson_reader *reader)
+{
+    assert(reader->event == CJSON_READ_BOOL);
+    return reader->value.boolean;
+}
+
+int64_t cjson_reader_get_int64(cjson_reader *reader)
+{
+    assert(reader->event == CJSON_READ_INTEGER);
+    return reader->value.integer;
+}
+
+uint64_t cjson_reader_get_uint64(cjson_reader *reader)
+{
+    if (reader->event == CJSON_READ_UNSIGNED)
+        return reader->value.unsigned_integer;
+    assert(reader->event == CJSON_READ_INTEGER && reader->value.integer >= 0);
+    return reader->value.integer;
+}
+
+double cjson_reader_get_double(cjson_reader *reader)
+{
+    switch (reader->event)
+    {
+    case CJSON_READ_INTEGER:
+        return reader->value.integer;
+    case CJSON_READ_UNSIGNED:
+        return reader->value.unsigned_integer;
+    default:
+        assert(reader->event == CJSON_READ_FLOAT);
+        return reader->value.fraction;
+    }
+}
+
+const char *cjson_reader_get_string(cjson_reader *reader, size_t *len)
+{
+    assert(reader->event == CJSON_READ_STRING || reader->event == CJSON_READ_KEY);
+    *len = reader->len;
+    return reader->str;
+}
+
+void cjson_reader_delete(cjson_reader *reader)
+{
+    if (reader == NULL)
+        return;
+    cjson_lexer_release(&reader->lexer);
+    free(reader);
+}
+
+/*
+ * Path segments, in the syntax of cjson_get_element_from: ".name" or "[i]".
+ */
+typedef struct
+{
+    // member name, not NUL-terminated, or NULL for an array index
+    const char *name;
+    size_t name_len;
+    size_t index;
+} cjson_path_segment;
+
+/**
+ * @brief reads the segment path starts with, returns what follows it or NULL
+ *        if it is malformed
+ */
+static const char *cjson_path_segment_read(const char *path, cjson_path_segment *segment)
+{
+    if (path[0] == '.')
+    {
+        if (!isalpha(path[1]) && path[1] != '_')
+            return NULL;
+        segment->name = path + 1;
+        segment->name_len = strspn(path + 1,
+                "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789");
+        return path + 1 + segment->name_len;
+    }
+    if (path[0] != '[' || !isdigit(path[1]))
+        return NULL;
+    char *end;
+    errno = 0;
+    unsigned long long index = strtoull(path + 1, &end, 10);
+    if (*end != ']' || errno != 0 || index > SIZE_MAX)
+        return NULL;
+    segment->name = NULL;
+    segment->index = index;
+    return end + 1;
+}
+
+/*
+ * Selective parse. The paths are merged into a trie walked along with the
+ * parse events: containers on the way to a path end are created empty and
+ * filled as their selected values come, values at a path end are built whole
+ * by a cjson_dom_builder, and the handler stops the parse on containers off
+ * every path for cjson_lexer_skip_container to pass over them.
+ */
+
+// no trie node, for values off every path
+#define CJSON_SELECT_NONE SIZE_MAX
+
+typedef struct
+{
+    // the member name or, if it is NULL, the array index leading here
+    char *name;
+    size_t name_len;
+    size_t index;
+    // a path ends here
+    bool whole;
+    // first child and next sibling, 0 for none since the root is node 0
+    size_t child;
+    size_t sibling;
+} cjson_select_node;
+
+typedef struct
+{
+    cjson_element *element;
+    size_t node;
+    // node the last key of an object leads to
+    size_t member;
+    // index of the next element of an array
+    size_t index;
+} cjson_select_frame;
+
+typedef struct
+{
+    cjson_select_node *nodes;
+    size_t nodes_size;
+    size_t nodes_capacity;
+    // containers kept, from the outermost
+    cjson_select_frame *frames;
+    size_t frames_size;
+    size_t frames_capacity;
+    cjson_element *root;
+    // builds the value at a path end, that goes where target leads
+    cjson_dom_builder dom;
+    bool building;
+    size_t target;
+} cjson_select;
+
+/**
+ * @brief returns the child of node reached by segment, adding it if create,
+ *        or CJSON_SELECT_NONE
+ */
+static size_t cjson_select_child(cjson_select *select, size_t node,
+        const cjson_path_segment *segment, bool create)
+{
+    for (size_t child = select->nodes[node].child; child != 0;
+            child = select->nodes[child].sibling)
+    {
+        cjson_select_node *candidate = &select->nodes[child];
+        if (segment->name == NULL ? candidate->name == NULL && candidate->index == segment->index
+                : candidate->name != NULL && candidate->name_len == segment->name_len
+                    && memcmp(candidate->name, segment->name, segment->name_len) == 0)
+            return child;
+    }
+    if (!create)
+        return CJSON_SELECT_NONE;
+    if (select->nodes_size == select->nodes_capacity)
+    {
+        select->nodes_capacity = select->nodes_capacity == 0 ? 16 : select->nodes_capacity * 2;
+        select->nodes = realloc(select->nodes, select->nodes_capacity * sizeof(cjson_select_node));
+    }
+    size_t child = select->nodes_size++;
+    cjson_select_node *res = &select->nodes[child];
+    memset(res, 0, sizeof(cjson_select_node));
+    if (segment->name != NULL)
+    {
+        res->name = cjson_strndup(NULL, segment->name, segment->name_len);
+        res->name_len = segment->name_len;
+    }
+    res->index = segment->index;
+    res->sibling = select->nodes[node].child;
+    select->nodes[node].child = child;
+    return child;
+}
+
+/**
+ * @brief adds a path to the trie, returns false if it is malformed
+ */
+static bool cjson_select_add(cjson_select *select, const char *path)
+{
+    size_t node = 0;
+    cjson_path_segment segment;
+    while (*path != '\0')
+    {
+        path = cjson_path_segment_read(path, &segment);
+        if (path == NULL)
+            return false;
+        node = cjson_select_child(select, node, &segment, true);
+    }
+    select->nodes[node].whole = true;
+    return true;
+}
+
+/**
+ * @brief returns the node of the value starting, CJSON_SELECT_NONE if it is
+ *        off every path
+ */
+static size_t cjson_select_target(cjson_select *select)
+{
+    if (select->frames_size == 0)
+        return 0;
+    cjson_select_frame *frame = &select->frames[select->frames_size - 1];
+    if (frame->element->element_type == CJSON_OBJECT)
+        return frame->member;
+    cjson_path_segment segment = { .name = NULL, .index = frame->index++ };
+    return cjson_select_child(select, frame->node, &segment, false);
+}
+
+/**
+ * @brief puts a kept value where node leads in the innermost container, after
+ *        nulls standing for the array elements skipped before it
+ */
+static void cjson_select_attach(cjson_select *select, size_t node, cjson_element *value)
+{
+    if (select->frames_size == 0)
+    {
+        select->root = value;
+        return;
+    }
+    cjson_element *container = select->frames[select->frames_size - 1].element;
+    if (container->element_type == CJSON_OBJECT)
+    {
+        cjson_object_insert(cjson_as_object(container), select->nodes[node].name, value);
+        return;
+    }
+    cjson_array *array = cjson_as_array(container);
+    while (array->size < select->nodes[node].index)
+        cjson_array_append(array, cjson_create_null());
+    cjson_array_append(array, value);
+}
+
+/**
+ * @brief returns true if the scalar starting is kept, then given to the
+ *        builder
+ */
+static bool cjson_select_scalar(cjson_select *select)
+{
+    if (select->building)
+        return true;
+    size_t node = cjson_select_target(select);
+    // The root is always kept
+    if (node == CJSON_SELECT_NONE || (!select->nodes[node].whole && select->frames_size > 0))
+        return false;
+    select->target = node;
+    return true;
+}
+
+/**
+ * @brief attaches the value the builder completed, if any
+ */
+static bool cjson_select_built(cjson_select *select)
+{
+    if (select->dom.frames_size == 0)
+    {
+        cjson_select_attach(select, select->target, select->dom.root);
+        select->dom.root = NULL;
+        select->building = false;
+    }
+    return true;
+}
+
+/**
+ * @brief handles the start of a container: returns false to have it skipped,
+ *        true to go on, building it if it is at a path end
+ */
+static bool cjson_select_open(cjson_select *select, bool object)
+{
+    if (select->building)
+        return true;
+    size_t node = cjson_select_target(select);
+    if (node == CJSON_SELECT_NONE)
+        return false;
+    if (select->nodes[node].whole)
+    {
+        select->building = true;
+        select->target = node;
+        return true;
+    }
+    // Below the root, a container is only kept if a path goes on into it
+    size_t child = select->nodes[node].child;
+    while (child != 0 && (select->nodes[child].name != NULL) != object)
+        child = select->nodes[child].sibling;
+    if (child == 0 && select->frames_size > 0)
+        return false;
+    cjson_element *element = object ? cjson_create_object(0) : cjson_create_array();
+    cjson_select_attach(select, node, element);
+    if (select->frames_size == select->frames_capacity)
+    {
+        select->frames_capacity = select->frames_capacity == 0 ? 16 : select->frames_capacity * 2;
+        select->frames = realloc(select->frames, select->frames_capacity * sizeof(cjson_select_frame));
+    }
+    select->frames[select->frames_size++] = (cjson_select_frame){
+        .element = element,
+        .node = node,
+        .member = CJSON_SELECT_NONE,
+        .index = 0,
+    };
+    return true;
+}
+
+static bool cjson_select_null(void *ctx)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_null(&select->dom) && cjson_select_built(select);
+}
+
+static bool cjson_select_boolean(void *ctx, bool value)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_boolean(&select->dom, value) && cjson_select_built(select);
+}
+
+static bool cjson_select_integer(void *ctx, int64_t value)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_integer(&select->dom, value) && cjson_select_built(select);
+}
+
+static bool cjson_select_unsigned_integer(void *ctx, uint64_t value)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_unsigned_integer(&select->dom, value) && cjson_select_built(select);
+}
+
+static bool cjson_select_fraction(void *ctx, double value)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_fraction(&select->dom, value) && cjson_select_built(select);
+}
+
+static bool cjson_select_string(void *ctx, const char *str, size_t len)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_scalar(select))
+        return true;
+    return cjson_dom_string(&select->dom, str, len) && cjson_select_built(select);
+}
+
+static bool cjson_select_start_object(void *ctx)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_open(select, true))
+        return false;
+    return !select->building || cjson_dom_start_object(&select->dom);
+}
+
+static bool cjson_select_key(void *ctx, const char *str, size_t len)
+{
+    cjson_select *select = ctx;
+    if (select->building)
+        return cjson_dom_key(&select->dom, str, len);
+    cjson_select_frame *frame = &select->frames[select->frames_size - 1];
+    cjson_path_segment segment = { .name = str, .name_len = len };
+    frame->member = cjson_select_child(select, frame->node, &segment, false);
+    return true;
+}
+
+static bool cjson_select_end_object(void *ctx)
+{
+    cjson_select *select = ctx;
+    if (select->building)
+        return cjson_dom_end_object(&select->dom) && cjson_select_built(select);
+    select->frames_size--;
+    return true;
+}
+
+static bool cjson_select_start_array(void *ctx)
+{
+    cjson_select *select = ctx;
+    if (!cjson_select_open(select, false))
+        return false;
+    return !select->building || cjson_dom_start_array(&select->dom);
+}
+
+static bool cjson_select_end_array(void *ctx)
+{
+    cjson_select *select = ctx;
+    if (select->building)
+        return cjson_dom_end_array(&select->dom) && cjson_select_built(select);
+    select->frames_size--;
+    return true;
+}
+
+static const cjson_handler cjson_select_handler = {
+    .null = cjson_select_null,
+    .boolean = cjson_select_boolean,
+    .integer = cjson_select_integer,
+    .unsigned_integer = cjson_select_unsigned_integer,
+    .fraction = cjson_select_fraction,
+    .string = cjson_select_string,
+    .start_object = cjson_select_start_object,
+    .key = cjson_select_key,
+    .end_object = cjson_select_end_object,
+    .start_array = cjson_select_start_array,
+    .end_array = cjson_select_end_array,
+};
+
+cjson_element *cjson_parse_select(const char *buf, size_t len, char **paths, size_t n)
+{
+    cjson_select select;
+    memset(&select, 0, sizeof(cjson_select));
+    select.nodes_capacity = 16;
+    select.nodes = calloc(select.nodes_capacity, sizeof(cjson_select_node));
+    select.nodes_size = 1;
+    bool valid = true;
+    for (size_t i = 0; i < n && valid; i++)
+        valid = cjson_select_add(&select, paths[i]);
+    if (valid)
+    {
+        cjson_lexer lexer;
+        cjson_lexer_init(&lexer, buf, len, true);
+        cjson_lexer_options(&lexer, &cjson_default_parse_options);
+        cjson_dom_init(&select.dom, NULL, false);
+        int status;
+        // The handler only stops on containers to skip
+        while ((status = cjson_lexer_parse(&lexer, &cjson_select_handler, &select))
+                == CJSON_PARSE_STOPPED)
+        {
+            if (!cjson_lexer_skip_container(&lexer))
+            {
+                status = CJSON_PARSE_ERROR;
+                break;
+            }
+        }
+        valid = status == CJSON_PARSE_DONE;
+        cjson_dom_release(&select.dom);
+        cjson_lexer_release(&lexer);
+    }
+    if (!valid)
+    {
+        cjson_delete(select.root);
+        select.root = NULL;
+    }
+    for (size_t i = 0; i < select.nodes_size; i++)
+        free(select.nodes[i].name);
+    free(select.nodes);
+    free(select.frames);
+    return select.root;
+}
+
+
+bool cjson_as_bool(cjson_element *element)
+{
+    assert(cjson_is_bool(element));
+    return element->value.boolean.value;
+}
+
+bool cjson_is_bool(cjson_element *element)
+{
+    return element->element_type == CJSON_BOOL;
+}
+
+cjson_element *cjson_create_bool(bool value)
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_BOOL;
+    res->value.boolean.value = value;
+    return res;
+}
+
+int cjson_as_integer(cjson_element *element)
+{
+    assert(cjson_is_integer(element));
+    return element->value.integer.value;
+}
+
+bool cjson_is_integer(cjson_element *element)
+{
+    return element->element_type == CJSON_INTEGER;
+}
+
+int64_t cjson_as_int64(cjson_element *element)
+{
+    assert(cjson_is_integer(element));
+    return element->value.integer.value;
+}
+
+cjson_element *cjson_create_integer(int value)
+{
+    return cjson_create_int64(value);
+}
+
+cjson_element *cjson_create_int64(int64_t value)
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_INTEGER;
+    res->value.integer.value = value;
+    return res;
+}
+
+uint64_t cjson_as_uint64(cjson_element *element)
+{
+    if (cjson_is_unsigned(element))
+        return element->value.unsigned_integer.value;
+    assert(cjson_is_integer(element) && element->value.integer.value >= 0);
+    return element->value.integer.value;
+}
+
+bool cjson_is_unsigned(cjson_element *element)
+{
+    return element->element_type == CJSON_UNSIGNED;
+}
+
+cjson_element *cjson_create_uint64(uint64_t value)
+{
+    if (value <= INT64_MAX)
+        return cjson_create_int64(value);
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_UNSIGNED;
+    res->value.unsigned_integer.value = value;
+    return res;
+}
+
+double cjson_as_float(cjson_element *element)
+{
+    assert(cjson_is_float(element));
+    return element->value.fraction.value;
+}
+
+bool cjson_is_float(cjson_element *element)
+{
+    return element->element_type == CJSON_FLOAT;
+}
+
+cjson_element *cjson_create_float(double value)
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_FLOAT;
+    res->value.fraction.value = value;
+    return res;
+}
+
+char *cjson_as_string(cjson_element *element)
+{
+    assert(cjson_is_string(element));
+    return element->value.string.value;
+}
+
+bool cjson_is_string(cjson_element *element)
+{
+    return element->element_type == CJSON_STRING;
+}
+
+cjson_element *cjson_create_string(char *value)
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_STRING;
+    res->value.string.value = strdup(value);
+    return res;
+}
+
+void cjson_array_append(cjson_array *array, cjson_element *element)
+{
+    if (array->capacity == 0)
+    {
+        array->capacity = 8;
+        array->elements = malloc(array->capacity * sizeof(cjson_element *));
+    }
+    if (array->size == array->capacity)
+    {
+        array->capacity *= 2;
+        array->elements = realloc(array->elements, array->capacity * sizeof(cjson_element *));
+    }
+    array->elements[array->size++] = element;
+}
+
+void cjson_array_insert(cjson_array *array, cjson_element *element, size_t index)
+{
+    cjson_array_append(array, element);
+    size_t current = array->size - 1;
+    while (current > index)
+    {
+        cjson_element *tmp = array->elements[current - 1];
+        array->elements[current - 1] = array->elements[current];
+        array->elements[current] = tmp;
+        current -= 1;
+    }
+}
+
+cjson_array *cjson_as_array(cjson_element *element)
+{
+    assert(cjson_is_array(element));
+    return &element->value.array;
+}
+
+cjson_element *cjson_create_array()
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_ARRAY;
+    return res;
+}
+
+bool cjson_is_array(cjson_element *element)
+{
+    return element->element_type == CJSON_ARRAY;
+}
+
+cjson_element *cjson_object_get(cjson_object *object, char *name)
+{
+    cjson_map_item *item = cjson_map_find(&object->members, name,
+            cjson_hash(name, strlen(name)));
+    if (item != NULL)
+        return item->element;
+    return NULL;
+}
+
+void cjson_object_insert(cjson_object *object, char *name, cjson_element *value)
+{
+    cjson_map_insert(&object->members, name, value);
+}
+
+cjson_object *cjson_as_object(cjson_element *element)
+{
+    assert(element->element_type == CJSON_OBJECT);
+    return &element->value.object;
+}
+
+bool cjson_is_object(cjson_element *element)
+{
+    return element->element_type == CJSON_OBJECT;
+}
+
+cjson_element *cjson_create_object(size_t capacity)
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_OBJECT;
+    cjson_map_reserve(&res->value.object.members, NULL, capacity);
+    return res;
+}
+
+void *cjson_as_null(cjson_element *element)
+{
+    assert(cjson_is_null(element));
+    return NULL;
+}
+
+bool cjson_is_null(cjson_element *element)
+{
+    return element->element_type == CJSON_NULL;
+}
+
+cjson_element *cjson_create_null()
+{
+    cjson_element *res = calloc(1, sizeof(cjson_element));
+    res->element_type = CJSON_NULL;
+    return res;
+}
+
+cjson_element *cjson_get_element_from_object(cjson_element *element, char *from)
+{
+    assert(cjson_is_object(element));
+    assert((isalpha(from[1]) || from[1] == '_') && "invalid member name");
+    cjson_object *object = cjson_as_object(element);
+    size_t name_len = strspn(
+            from + 1,
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789");
+    char *name = strndup(from + 1, name_len);
+    cjson_element *elt_at_name = cjson_object_get(object, name);
+    assert(elt_at_name && "object does not contain member");
+    free(name);
+    if (from[name_len + 1] == '\0')
+        return elt_at_name;
+    return cjson_get_element_from(elt_at_name, from + name_len + 1);
+}
+
+cjson_element *cjson_get_element_from_array(cjson_element *element, char *from)
+{
+    assert(cjson_is_array(element));
+    cjson_array *array = cjson_as_array(element);
+    char *endptr = NULL;
+    size_t i = strtoul(from + 1, &endptr, 10);
+    assert(*endptr == ']' && "invalid syntax when indexing");
+    cjson_element *elt_at_i = array->elements[i];
+    if (endptr[1] == '\0')
+        return elt_at_i;
+    return cjson_get_element_from(elt_at_i, endptr + 1);
+}
+
+cjson_element *cjson_get_element_from(cjson_element *element, char *from)
+{
+    if (*from == '[')
+        return cjson_get_element_from_array(element, from);
+    else if (*from == '.')
+        return cjson_get_element_from_object(element, from);
+    assert(0 && "invalid syntax when getting from string path");
+}
+
+typedef struct
+{
+    // member name, NULL for an array index
+    char *name;
+    size_t hash;
+    size_t index;
+} cjson_path_step;
+
+/*
+ * The member names of a compiled path follow its steps, in the same
+ * allocation.
+ */
+struct cjson_path
+{
+    size_t size;
+    cjson_path_step steps[];
+};
+
+cjson_path *cjson_path_compile(const char *path)
+{
+    size_t size = 0;
+    size_t names_size = 0;
+    cjson_path_segment segment;
+    for (const char *p = path; *p != '\0'; size++)
+    {
+        p = cjson_path_segment_read(p, &segment);
+        if (p == NULL)
+            return NULL;
+        if (segment.name != NULL)
+            names_size += segment.name_len + 1;
+    }
+    cjson_path *res = malloc(sizeof(cjson_path) + size * sizeof(cjson_path_step) + names_size);
+    res->size = size;
+    char *names = (char *)(res->steps + size);
+    for (size_t i = 0; i < size; i++)
+    {
+        path = cjson_path_segment_read(path, &segment);
+        cjson_path_step *step = &res->steps[i];
+        if (segment.name == NULL)
+        {
+            step->name = NULL;
+            step->hash = 0;
+            step->index = segment.index;
+            continue;
+        }
+        memcpy(names, segment.name, segment.name_len);
+        names[segment.name_len] = '\0';
+        step->name = names;
+        step->hash = cjson_hash(names, segment.name_len);
+        step->index = 0;
+        names += segment.name_len + 1;
+    }
+    return res;
+}
+
+/**
+ * @brief returns the member or array element step leads to from element, NULL
+ *        if it is missing
+ */
+static inline cjson_element *cjson_path_step_eval(const cjson_path_step *step,
+        cjson_element *element)
+{
+    if (step->name != NULL)
+    {
+        if (element->element_type != CJSON_OBJECT)
+            return NULL;
+        cjson_map_item *item = cjson_map_find(&element->value.object.members,
+                step->name, step->hash);
+        return item == NULL ? NULL : item->element;
+    }
+    if (element->element_type != CJSON_ARRAY || step->index >= element->value.array.size)
+        return NULL;
+    return element->value.array.elements[step->index];
+}
+
+static bool cjson_path_step_equal(const cjson_path_step *a, const cjson_path_step *b)
+{
+    if (a->name == NULL || b->name == NULL)
+        return a->name == b->name && a->index == b->index;
+    return a->hash == b->hash && strcmp(a->name, b->name) == 0;
+}
+
+cjson_element *cjson_path_eval(const cjson_path *path, cjson_element *element)
+{
+    for (size_t i = 0; i < path->size && element != NULL; i++)
+        element = cjson_path_step_eval(&path->steps[i], element);
+    return element;
+}
+
+void cjson_path_delete(cjson_path *path)
+{
+    free(path);
+}
+
+/*
+ * The prefix tree of a path set is laid out in preorder: the first child of
+ * a node follows it and the next sibling of a node follows its subtree.
+ */
+typedef struct
+{
+    cjson_path_step step;
+    // index past the subtree of the node
+    size_t end;
+    // first path ending at the node plus one, 0 for none
+    size_t output;
+} cjson_path_node;
+
+struct cjson_path_set
+{
+    // paths ending at the same node are chained, each one plus one
+    size_t *next_output;
+    size_t size;
+    cjson_path_node *nodes;
+    size_t nodes_size;
+};
+
+/*
+ * Nodes of the prefix tree while it is built, linked to their first child and
+ * next sibling.
+ */
+typedef struct
+{
+    const cjson_path_step *step;
+    size_t child;
+    size_t sibling;
+    size_t output;
+} cjson_path_trie;
+
+/**
+ * @brief lays the subtree of node out from set->nodes_size on
+ */
+static void cjson_path_set_flatten(cjson_path_set *set, const cjson_path_trie *trie,
+        size_t node)
+{
+    cjson_path_node *res = &set->nodes[set->nodes_size++];
+    res->output = trie[node].output;
+    if (trie[node].step == NULL || trie[node].step->name == NULL)
+    {
+        res->step.name = NULL;
+        res->step.hash = 0;
+        res->step.index = trie[node].step == NULL ? 0 : trie[node].step->index;
+    }
+    else
+    {
+        res->step = *trie[node].step;
+        res->step.name = cjson_strndup(NULL, res->step.name, strlen(res->step.name));
+    }
+    for (size_t child = trie[node].child; child != 0; child = trie[child].sibling)
+        cjson_path_set_flatten(set, trie, child);
+    res->end = set->nodes_size;
+}
+
+cjson_path_set *cjson_path_set_new(cjson_path **paths, size_t n)
+{
+    size_t capacity = 1;
+    for (size_t i = 0; i < n; i++)
+        capacity += paths[i]->size;
+    cjson_path_trie *trie = calloc(capacity, sizeof(cjson_path_trie));
+    size_t trie_size = 1;
+    cjson_path_set *set = malloc(sizeof(cjson_path_set));
+    set->next_output = malloc((n == 0 ? 1 : n) * sizeof(size_t));
+    set->size = n;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t node = 0;
+        for (size_t j = 0; j < paths[i]->size; j++)
         {
-            if (input[token_len] == '\\')
+            const cjson_path_step *step = &paths[i]->steps[j];
+            size_t child = trie[node].child;
+            while (child != 0 && !cjson_path_step_equal(trie[child].step, step))
+                child = trie[child].sibling;
+            if (child == 0)
             {
-                switch (input[token_len + 1])
-                {
-                case '"': case '\\': case '/': case 'b': case 'f': case 'n':
-                case 'r': case 't':
-                    token_len += 2;
-                    break;
-                case 'u':
-                    token_len += 2;
-                    for (size_t end = token_len + 4; token_len < end; token_len++)
-                    {
-                        if (!(isalnum(input[token_len]) && tolower(input[token_len]) <= 'f'))
-                            goto token_error;
-                    }
-                    break;
-                default:
-                    goto token_error;
-                }
+                child = trie_size++;
+                trie[child].step = step;
+                trie[child].sibling = trie[node].child;
+                trie[node].child = child;
+            }
+            node = child;
+        }
+        set->next_output[i] = trie[node].output;
+        trie[node].output = i + 1;
+    }
+    set->nodes = malloc(trie_size * sizeof(cjson_path_node));
+    set->nodes_size = 0;
+    cjson_path_set_flatten(set, trie, 0);
+    free(trie);
+    return set;
+}
+
+/**
+ * @brief fills the outputs of node, reached at element, and of its subtree
+ */
+static void cjson_path_set_walk(const cjson_path_set *set, size_t node,
+        cjson_element *element, cjson_element **out)
+{
+    const cjson_path_node *current = &set->nodes[node];
+    for (size_t output = current->output; output != 0; output = set->next_output[output - 1])
+        out[output - 1] = element;
+    for (size_t child = node + 1; child < current->end; child = set->nodes[child].end)
+    {
+        cjson_element *value = cjson_path_step_eval(&set->nodes[child].step, element);
+        if (value != NULL)
+            cjson_path_set_walk(set, child, value, out);
+    }
+}
+
+void cjson_path_set_eval(const cjson_path_set *set, cjson_element *element,
+        cjson_element **out)
+{
+    for (size_t i = 0; i < set->size; i++)
+        out[i] = NULL;
+    cjson_path_set_walk(set, 0, element, out);
+}
+
+void cjson_path_set_delete(cjson_path_set *set)
+{
+    if (set == NULL)
+        return;
+    for (size_t i = 0; i < set->nodes_size; i++)
+        free(set->nodes[i].step.name);
+    free(set->nodes);
+    free(set->next_output);
+    free(set);
+}
+
+/*
+ * JSONPath queries. Each selector is an instruction turning one element into
+ * a sequence of them, and the iterator keeps a stack of cursors, one per
+ * instruction that can give several elements: the next result is found by
+ * advancing the innermost cursor that is not exhausted, following the
+ * instructions after it that give at most one element, and starting a cursor
+ * for the next one from there.
+ */
+
+enum
+{
+    CJSON_QUERY_MEMBER,
+    CJSON_QUERY_INDEX,
+    CJSON_QUERY_WILDCARD,
+    CJSON_QUERY_SLICE,
+    CJSON_QUERY_DESCENDANTS,
+    CJSON_QUERY_FILTER,
+};
+
+// Comparisons of filters
+enum
+{
+    CJSON_QUERY_EXISTS,
+    CJSON_QUERY_EQ,
+    CJSON_QUERY_NE,
+    CJSON_QUERY_LT,
+    CJSON_QUERY_LE,
+    CJSON_QUERY_GT,
+    CJSON_QUERY_GE,
+};
+
+typedef struct
+{
+    int op;
+    // CJSON_QUERY_MEMBER
+    cjson_path_step member;
+    size_t member_len;
+    // CJSON_QUERY_INDEX in start, and CJSON_QUERY_SLICE whose bounds are
+    // optional
+    int64_t start;
+    int64_t end;
+    int64_t step;
+    bool has_start;
+    bool has_end;
+    // CJSON_QUERY_FILTER: path from the candidates to what is compared to
+    // value
+    cjson_path *operand;
+    int comparison;
+    cjson_element *value;
+} cjson_query_instruction;
+
+struct cjson_query
+{
+    cjson_query_instruction *code;
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * @brief returns the number of members or elements of element
+ */
+static inline size_t cjson_query_children(cjson_element *element)
+{
+    if (element->element_type == CJSON_ARRAY)
+        return element->value.array.size;
+    if (element->element_type == CJSON_OBJECT)
+        return element->value.object.members.size;
+    return 0;
+}
+
+/**
+ * @brief returns the i-th member value or element of element
+ */
+static inline cjson_element *cjson_query_child(cjson_element *element, size_t i)
+{
+    if (element->element_type == CJSON_ARRAY)
+        return element->value.array.elements[i];
+    return element->value.object.members.items[i].element;
+}
+
+static const char *cjson_query_skip_spaces(const char *p)
+{
+    while (*p == ' ')
+        p++;
+    return p;
+}
+
+/**
+ * @brief reads the quoted string p starts with, its quote being ' or ".
+ *        returns what follows it or NULL if it is malformed, and sets str to
+ *        the decoded string, to be freed
+ */
+static const char *cjson_query_read_string(const char *p, char **str)
+{
+    char quote = *p++;
+    size_t len = 0;
+    while (p[len] != quote)
+    {
+        if (p[len] == '\0' || (p[len] == '\\' && p[len + 1] == '\0'))
+            return NULL;
+        len += p[len] == '\\' ? 2 : 1;
+    }
+    // cjson_unescape knows every escape but \', and keeps bare quotes as is
+    char *res = malloc(len + 1);
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (p[i] == '\\' && p[i + 1] == '\'')
+            i++;
+        else if (p[i] == '\\')
+            res[j++] = p[i++];
+        res[j++] = p[i];
+    }
+    if (cjson_unescape(res, res, j, true) == SIZE_MAX)
+    {
+        free(res);
+        return NULL;
+    }
+    *str = res;
+    return p + len + 1;
+}
+
+/**
+ * @brief reads the integer p starts with into value, returns what follows it
+ *        or NULL if there is none
+ */
+static const char *cjson_query_read_integer(const char *p, int64_t *value)
+{
+    if (!isdigit(p[p[0] == '-']))
+        return NULL;
+    char *end;
+    errno = 0;
+    long long res = strtoll(p, &end, 10);
+    if (errno != 0)
+        return NULL;
+    *value = res;
+    return end;
+}
+
+static cjson_query_instruction *cjson_query_emit(cjson_query *query, int op)
+{
+    if (query->size == query->capacity)
+    {
+        query->capacity = query->capacity == 0 ? 8 : query->capacity * 2;
+        query->code = realloc(query->code, query->capacity * sizeof(cjson_query_instruction));
+    }
+    cjson_query_instruction *res = &query->code[query->size++];
+    memset(res, 0, sizeof(cjson_query_instruction));
+    res->op = op;
+    return res;
+}
+
+/**
+ * @brief emits a member instruction taking ownership of name
+ */
+static void cjson_query_emit_member(cjson_query *query, char *name)
+{
+    cjson_query_instruction *instruction = cjson_query_emit(query, CJSON_QUERY_MEMBER);
+    instruction->member.name = name;
+    instruction->member_len = strlen(name);
+    instruction->member.hash = cjson_hash(name, instruction->member_len);
+}
+
+/**
+ * @brief reads the dot member name p starts with, which is made of letters,
+ *        digits, underscores and non-ASCII characters and does not start with
+ *        a digit. returns its length
+ */
+static size_t cjson_query_name_len(const char *p)
+{
+    if (isdigit(*p))
+        return 0;
+    size_t len = 0;
+    while (isalnum(p[len]) || p[len] == '_' || (unsigned char)p[len] >= 0x80)
+        len++;
+    return len;
+}
+
+/**
+ * @brief compiles the filter p starts with, after "?". returns what follows
+ *        it or NULL if it is malformed
+ */
+static const char *cjson_query_compile_filter(cjson_query *query, const char *p)
+{
+    bool parenthesized = *p == '(';
+    p = cjson_query_skip_spaces(p + parenthesized);
+    if (*p++ != '@')
+        return NULL;
+    const char *path = p;
+    cjson_path_segment segment;
+    while (*p == '.' || *p == '[')
+    {
+        p = cjson_path_segment_read(p, &segment);
+        if (p == NULL)
+            return NULL;
+    }
+    cjson_query_instruction *instruction = cjson_query_emit(query, CJSON_QUERY_FILTER);
+    char *operand = cjson_strndup(NULL, path, p - path);
+    instruction->operand = cjson_path_compile(operand);
+    free(operand);
+
+    static const struct
+    {
+        const char *token;
+        int comparison;
+    } comparisons[] = {
+        { "==", CJSON_QUERY_EQ }, { "!=", CJSON_QUERY_NE }, { "<=", CJSON_QUERY_LE },
+        { ">=", CJSON_QUERY_GE }, { "<", CJSON_QUERY_LT }, { ">", CJSON_QUERY_GT },
+    };
+    p = cjson_query_skip_spaces(p);
+    instruction->comparison = CJSON_QUERY_EXISTS;
+    for (size_t i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++)
+    {
+        size_t len = strlen(comparisons[i].token);
+        if (strncmp(p, comparisons[i].token, len) == 0)
+        {
+            instruction->comparison = comparisons[i].comparison;
+            p = cjson_query_skip_spaces(p + len);
+            break;
+        }
+    }
+    if (instruction->comparison != CJSON_QUERY_EXISTS)
+    {
+        if (*p == '\'' || *p == '"')
+        {
+            char *str;
+            p = cjson_query_read_string(p, &str);
+            if (p == NULL)
+                return NULL;
+            instruction->value = cjson_create_string(str);
+            free(str);
+        }
+        else
+        {
+            // Numbers and literal names, as they are written in JSON
+            size_t len = strcspn(p, " )]");
+            instruction->value = cjson_parse_n(p, len, NULL);
+            if (instruction->value == NULL
+                    || instruction->value->element_type == CJSON_ARRAY
+                    || instruction->value->element_type == CJSON_OBJECT
+                    || instruction->value->element_type == CJSON_STRING)
+                return NULL;
+            p += len;
+        }
+        p = cjson_query_skip_spaces(p);
+    }
+    if (parenthesized && *p++ != ')')
+        return NULL;
+    return p;
+}
+
+/**
+ * @brief compiles the bracketed selector p starts with, after "[". returns
+ *        what follows it or NULL if it is malformed
+ */
+static const char *cjson_query_compile_bracket(cjson_query *query, const char *p)
+{
+    p = cjson_query_skip_spaces(p);
+    if (*p == '*')
+    {
+        cjson_query_emit(query, CJSON_QUERY_WILDCARD);
+        p++;
+    }
+    else if (*p == '\'' || *p == '"')
+    {
+        char *name;
+        p = cjson_query_read_string(p, &name);
+        if (p == NULL)
+            return NULL;
+        cjson_query_emit_member(query, name);
+    }
+    else if (*p == '?')
+        p = cjson_query_compile_filter(query, p + 1);
+    else
+    {
+        cjson_query_instruction *instruction = cjson_query_emit(query, CJSON_QUERY_INDEX);
+        const char *bound = cjson_query_read_integer(p, &instruction->start);
+        instruction->has_start = bound != NULL;
+        p = cjson_query_skip_spaces(bound == NULL ? p : bound);
+        if (*p == ':')
+        {
+            instruction->op = CJSON_QUERY_SLICE;
+            instruction->step = 1;
+            p = cjson_query_skip_spaces(p + 1);
+            bound = cjson_query_read_integer(p, &instruction->end);
+            instruction->has_end = bound != NULL;
+            p = cjson_query_skip_spaces(bound == NULL ? p : bound);
+            if (*p == ':')
+            {
+                p = cjson_query_skip_spaces(p + 1);
+                bound = cjson_query_read_integer(p, &instruction->step);
+                p = bound == NULL ? p : bound;
+                // Cursors going backwards negate the step
+                if (instruction->step == INT64_MIN)
+                    return NULL;
             }
+        }
+        else if (!instruction->has_start)
+            return NULL;
+    }
+    if (p == NULL)
+        return NULL;
+    p = cjson_query_skip_spaces(p);
+    return *p == ']' ? p + 1 : NULL;
+}
+
+cjson_query *cjson_query_compile(const char *expression)
+{
+    cjson_query *query = calloc(1, sizeof(cjson_query));
+    const char *p = expression;
+    if (*p++ != '$')
+        p = NULL;
+    while (p != NULL && *p != '\0')
+    {
+        if (p[0] == '.' && p[1] == '.')
+        {
+            cjson_query_emit(query, CJSON_QUERY_DESCENDANTS);
+            // ..[s] is the same as ..s
+            p += p[2] == '[' ? 2 : 1;
+        }
+        if (*p == '[')
+            p = cjson_query_compile_bracket(query, p + 1);
+        else if (*p != '.')
+            p = NULL;
+        else if (p[1] == '*')
+        {
+            cjson_query_emit(query, CJSON_QUERY_WILDCARD);
+            p += 2;
+        }
+        else
+        {
+            size_t len = cjson_query_name_len(p + 1);
+            if (len == 0)
+                p = NULL;
             else
-                token_len += 1;
+            {
+                cjson_query_emit_member(query, cjson_strndup(NULL, p + 1, len));
+                p += 1 + len;
+            }
         }
-        token_len += 1;
+    }
+    if (p == NULL)
+    {
+        cjson_query_delete(query);
+        return NULL;
+    }
+    return query;
+}
+
+void cjson_query_delete(cjson_query *query)
+{
+    if (query == NULL)
+        return;
+    for (size_t i = 0; i < query->size; i++)
+    {
+        free(query->code[i].member.name);
+        cjson_path_delete(query->code[i].operand);
+        cjson_delete(query->code[i].value);
+    }
+    free(query->code);
+    free(query);
+}
+
+// Result of cjson_query_order for values that are not ordered
+#define CJSON_QUERY_UNORDERED 2
+
+static bool cjson_query_number(cjson_element *element, double *value)
+{
+    switch (element->element_type)
+    {
+    case CJSON_INTEGER:
+        *value = element->value.integer.value;
+        return true;
+    case CJSON_UNSIGNED:
+        *value = element->value.unsigned_integer.value;
+        return true;
+    case CJSON_FLOAT:
+        *value = element->value.fraction.value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief returns -1, 0 or 1 if a is lower, equal or greater than b, which
+ *        must both be numbers or strings, CJSON_QUERY_UNORDERED otherwise
+ */
+static int cjson_query_order(cjson_element *a, cjson_element *b)
+{
+    // Integers are compared exactly, other numbers as doubles
+    if (a->element_type == CJSON_INTEGER && b->element_type == CJSON_INTEGER)
+        return (a->value.integer.value > b->value.integer.value)
+            - (a->value.integer.value < b->value.integer.value);
+    double x;
+    double y;
+    if (cjson_query_number(a, &x) && cjson_query_number(b, &y))
+        return (x > y) - (x < y);
+    if (a->element_type != CJSON_STRING || b->element_type != CJSON_STRING)
+        return CJSON_QUERY_UNORDERED;
+    int res = strcmp(a->value.string.value, b->value.string.value);
+    return (res > 0) - (res < 0);
+}
+
+static bool cjson_query_equal(cjson_element *a, cjson_element *b)
+{
+    if (a->element_type == CJSON_NULL || b->element_type == CJSON_NULL)
+        return a->element_type == b->element_type;
+    if (a->element_type == CJSON_BOOL || b->element_type == CJSON_BOOL)
+        return a->element_type == b->element_type
+            && a->value.boolean.value == b->value.boolean.value;
+    return cjson_query_order(a, b) == 0;
+}
+
+/**
+ * @brief returns true if element passes the filter
+ */
+static bool cjson_query_test(const cjson_query_instruction *instruction,
+        cjson_element *element)
+{
+    cjson_element *operand = cjson_path_eval(instruction->operand, element);
+    if (operand == NULL)
+        return false;
+    int order;
+    switch (instruction->comparison)
+    {
+    case CJSON_QUERY_EXISTS:
+        return true;
+    case CJSON_QUERY_EQ:
+        return cjson_query_equal(operand, instruction->value);
+    case CJSON_QUERY_NE:
+        return !cjson_query_equal(operand, instruction->value);
+    default:
+        order = cjson_query_order(operand, instruction->value);
+        if (order == CJSON_QUERY_UNORDERED)
+            return false;
+        switch (instruction->comparison)
+        {
+        case CJSON_QUERY_LT:
+            return order < 0;
+        case CJSON_QUERY_LE:
+            return order <= 0;
+        case CJSON_QUERY_GT:
+            return order > 0;
+        default:
+            return order >= 0;
+        }
+    }
+}
+
+/*
+ * Container whose children CJSON_QUERY_DESCENDANTS visits, and the position
+ * of the next one.
+ */
+typedef struct
+{
+    cjson_element *element;
+    size_t i;
+} cjson_query_visit;
+
+/*
+ * Cursor of the instruction at pc over what it selects from input: array
+ * elements or object members from i on, by step, until end.
+ * CJSON_QUERY_DESCENDANTS walks down from input with the visits stack instead,
+ * after giving input itself while i is 0.
+ */
+typedef struct
+{
+    size_t pc;
+    cjson_element *input;
+    int64_t i;
+    int64_t end;
+    int64_t step;
+    cjson_query_visit *visits;
+    size_t visits_size;
+    size_t visits_capacity;
+} cjson_query_frame;
+
+struct cjson_query_iterator
+{
+    const cjson_query *query;
+    // room for a cursor per instruction, the first active ones being run
+    cjson_query_frame *frames;
+    size_t active;
+    // the only result of a query without cursors, until it is given
+    cjson_element *single;
+};
+
+static int64_t cjson_query_clamp(int64_t value, int64_t low, int64_t high)
+{
+    return value < low ? low : value > high ? high : value;
+}
+
+/**
+ * @brief returns the element a member or index instruction selects from
+ *        input, NULL if there is none
+ */
+static cjson_element *cjson_query_select(const cjson_query_instruction *instruction,
+        cjson_element *input)
+{
+    if (instruction->op == CJSON_QUERY_MEMBER)
+    {
+        if (input->element_type != CJSON_OBJECT)
+            return NULL;
+        cjson_map_item *item = cjson_map_find(&input->value.object.members,
+                instruction->member.name, instruction->member.hash);
+        return item == NULL ? NULL : item->element;
+    }
+    if (input->element_type != CJSON_ARRAY)
+        return NULL;
+    int64_t len = input->value.array.size;
+    int64_t i = instruction->start < 0 ? instruction->start + len : instruction->start;
+    return i >= 0 && i < len ? input->value.array.elements[i] : NULL;
+}
+
+/**
+ * @brief follows from element the instructions from pc on that give at most
+ *        one element. returns where they lead, NULL if one gives none, and
+ *        sets pc past them
+ */
+static cjson_element *cjson_query_follow(const cjson_query *query, size_t *pc,
+        cjson_element *element)
+{
+    while (*pc < query->size && element != NULL
+            && (query->code[*pc].op == CJSON_QUERY_MEMBER || query->code[*pc].op == CJSON_QUERY_INDEX))
+        element = cjson_query_select(&query->code[(*pc)++], element);
+    return element;
+}
+
+/**
+ * @brief starts the cursor of the instruction at pc over input
+ */
+static void cjson_query_start(const cjson_query *query, size_t pc,
+        cjson_query_frame *frame, cjson_element *input)
+{
+    const cjson_query_instruction *instruction = &query->code[pc];
+    int64_t len = cjson_query_children(input);
+    frame->pc = pc;
+    frame->input = input;
+    frame->i = 0;
+    frame->end = 0;
+    frame->step = 1;
+    switch (instruction->op)
+    {
+    case CJSON_QUERY_DESCENDANTS:
+        frame->visits_size = 0;
         break;
-    case '\0':
-        lexer->token.type = CJSON_TOK_EOF;
+    case CJSON_QUERY_WILDCARD:
+    case CJSON_QUERY_FILTER:
+        frame->end = len;
+        break;
+    case CJSON_QUERY_SLICE:
+    {
+        int64_t step = instruction->step;
+        if (input->element_type != CJSON_ARRAY || step == 0)
+            break;
+        int64_t start = instruction->has_start ? instruction->start : step > 0 ? 0 : len - 1;
+        int64_t end = instruction->has_end ? instruction->end : step > 0 ? len : -len - 1;
+        start = start < 0 ? start + len : start;
+        end = end < 0 ? end + len : end;
+        frame->step = step;
+        frame->i = cjson_query_clamp(start, step > 0 ? 0 : -1, step > 0 ? len : len - 1);
+        frame->end = cjson_query_clamp(end, step > 0 ? 0 : -1, step > 0 ? len : len - 1);
         break;
+    }
+    }
+}
+
+/**
+ * @brief returns the next element the cursor of a descendants instruction
+ *        gives, NULL once it is exhausted
+ */
+static cjson_element *cjson_query_descend(cjson_query_frame *frame)
+{
+    cjson_element *res;
+    if (frame->i == 0)
+    {
+        frame->i = 1;
+        res = frame->input;
+    }
+    else
+    {
+        while (true)
+        {
+            if (frame->visits_size == 0)
+                return NULL;
+            cjson_query_visit *visit = &frame->visits[frame->visits_size - 1];
+            if (visit->i < cjson_query_children(visit->element))
+            {
+                res = cjson_query_child(visit->element, visit->i++);
+                break;
+            }
+            frame->visits_size--;
+        }
+    }
+    if (cjson_query_children(res) > 0)
+    {
+        if (frame->visits_size == frame->visits_capacity)
+        {
+            frame->visits_capacity = frame->visits_capacity == 0 ? 16 : frame->visits_capacity * 2;
+            frame->visits = realloc(frame->visits, frame->visits_capacity * sizeof(cjson_query_visit));
+        }
+        frame->visits[frame->visits_size++] = (cjson_query_visit){ .element = res, .i = 0 };
+    }
+    return res;
+}
+
+/**
+ * @brief returns the next element the cursor of instruction gives, NULL once
+ *        it is exhausted
+ */
+static cjson_element *cjson_query_advance(const cjson_query_instruction *instruction,
+        cjson_query_frame *frame)
+{
+    cjson_element *input = frame->input;
+    switch (instruction->op)
+    {
+    case CJSON_QUERY_DESCENDANTS:
+        return cjson_query_descend(frame);
+    case CJSON_QUERY_FILTER:
+        // The candidates are all tested here rather than one per call
+        while (frame->i < frame->end)
+        {
+            cjson_element *child = cjson_query_child(input, frame->i++);
+            if (cjson_query_test(instruction, child))
+                return child;
+        }
+        return NULL;
+    case CJSON_QUERY_WILDCARD:
+        if (frame->i == frame->end)
+            return NULL;
+        return cjson_query_child(input, frame->i++);
     default:
-token_error:
-        lexer->token.type = CJSON_TOK_ERROR;
+    {
+        int64_t i = frame->i;
+        int64_t step = frame->step;
+        if (step > 0 ? i >= frame->end : i <= frame->end)
+            return NULL;
+        // Steps past the end are not added, they could overflow
+        bool last = step > 0 ? frame->end - i <= step : i - frame->end <= -step;
+        frame->i = last ? frame->end : i + step;
+        return input->value.array.elements[i];
+    }
     }
-
-    lexer->token.content = input;
-    lexer->token.content_len = token_len;
-    lexer->location += token_len;
 }
 
-cjson_token cjson_lexer_peek(cjson_lexer *lexer)
+cjson_query_iterator *cjson_query_run(const cjson_query *query, cjson_element *element)
 {
-    if (lexer->token.type == CJSON_TOK_NONE)
-        cjson_read_next_token(lexer);
-    return lexer->token;
+    cjson_query_iterator *iterator = malloc(sizeof(cjson_query_iterator));
+    iterator->query = query;
+    iterator->frames = calloc(query->size == 0 ? 1 : query->size, sizeof(cjson_query_frame));
+    cjson_query_rewind(iterator, element);
+    return iterator;
 }
 
-cjson_token cjson_lexer_pop(cjson_lexer *lexer)
+void cjson_query_rewind(cjson_query_iterator *iterator, cjson_element *element)
 {
-    if (lexer->token.type == CJSON_TOK_NONE)
-        cjson_read_next_token(lexer);
-    cjson_token res = lexer->token;
-    lexer->token.type = CJSON_TOK_NONE;
-    return res;
+    const cjson_query *query = iterator->query;
+    size_t pc = 0;
+    element = cjson_query_follow(query, &pc, element);
+    iterator->single = NULL;
+    iterator->active = 0;
+    if (pc == query->size)
+        iterator->single = element;
+    else if (element != NULL)
+    {
+        cjson_query_start(query, pc, &iterator->frames[0], element);
+        iterator->active = 1;
+    }
 }
 
-cjson_element *cjson_parse_element(cjson_lexer *lexer, int *error);
+cjson_element *cjson_query_next(cjson_query_iterator *iterator)
+{
+    const cjson_query *query = iterator->query;
+    if (iterator->single != NULL)
+    {
+        cjson_element *res = iterator->single;
+        iterator->single = NULL;
+        return res;
+    }
+    while (iterator->active > 0)
+    {
+        cjson_query_frame *frame = &iterator->frames[iterator->active - 1];
+        cjson_element *element = cjson_query_advance(&query->code[frame->pc], frame);
+        if (element == NULL)
+        {
+            iterator->active--;
+            continue;
+        }
+        size_t pc = frame->pc + 1;
+        element = cjson_query_follow(query, &pc, element);
+        if (element == NULL)
+            continue;
+        if (pc == query->size)
+            return element;
+        cjson_query_start(query, pc, &iterator->frames[iterator->active++], element);
+    }
+    return NULL;
+}
 
-void cjson_parse_ws(cjson_lexer *lexer)
+void cjson_query_iterator_delete(cjson_query_iterator *iterator)
 {
-    while (isspace(lexer->content[lexer->location]))
-        lexer->location += 1;
+    if (iterator == NULL)
+        return;
+    for (size_t i = 0; i < iterator->query->size; i++)
+        free(iterator->frames[i].visits);
+    free(iterator->frames);
+    free(iterator);
 }
 
-void cjson_parse_member(cjson_lexer *lexer, cjson_map *map, int *error)
+/*
+ * Streaming queries. Every value of the document gets the set of states the
+ * query reaches it in, a state being the position of the next instruction to
+ * apply, times two, plus one for a candidate of the filter there. The states
+ * of the children of a container follow from its own and their key or index,
+ * as long as its instructions can be decided on these: the values that reach
+ * the end of the query, a filter or an index or slice needing the length of
+ * an array are built, then walked the same way, the instructions that could
+ * not be decided being finished with an iterator. Containers without states
+ * are skipped.
+ */
+
+typedef struct
+{
+    // states of the container, first on the states stack
+    size_t first;
+    size_t size;
+    bool object;
+    // index of the next element of an array
+    size_t index;
+} cjson_stream_frame;
+
+typedef struct
+{
+    const cjson_query *query;
+    cjson_query_callback callback;
+    void *ctx;
+    // sets of states of the containers being walked, then of the value
+    // starting from value_first on
+    size_t *states;
+    size_t states_size;
+    size_t states_capacity;
+    size_t value_first;
+    cjson_stream_frame *frames;
+    size_t frames_size;
+    size_t frames_capacity;
+    // builds the value starting, whose states need it
+    cjson_dom_builder dom;
+    bool building;
+    // set once callback returns false
+    bool stopped;
+} cjson_stream;
+
+// What the handler does with a value starting
+enum
+{
+    CJSON_STREAM_SKIP,
+    CJSON_STREAM_ENTER,
+    CJSON_STREAM_BUILD,
+};
+
+/**
+ * @brief adds a state to the set of the value starting, with the one after a
+ *        .. since it also applies to the value itself
+ */
+static void cjson_stream_add(cjson_stream *stream, size_t state)
 {
-    cjson_parse_ws(lexer);
-    cjson_token str = cjson_lexer_pop(lexer); // parse string
-    if (str.type != CJSON_TOK_STRING)
+    for (size_t i = stream->value_first; i < stream->states_size; i++)
     {
-        *error = 1;
-        return;
+        if (stream->states[i] == state)
+            return;
     }
-    char *name = strndup(str.content + 1, str.content_len - 2);
-    cjson_parse_ws(lexer);
-    if (cjson_lexer_peek(lexer).type != CJSON_TOK_COLON)
+    if (stream->states_size == stream->states_capacity)
     {
-        *error = 1;
-        return;
+        stream->states_capacity = stream->states_capacity == 0 ? 64 : stream->states_capacity * 2;
+        stream->states = realloc(stream->states, stream->states_capacity * sizeof(size_t));
     }
-    cjson_lexer_pop(lexer);
-    cjson_element *element = cjson_parse_element(lexer, error);
-    cjson_map_insert(map, name, element);
-    free(name);
+    stream->states[stream->states_size++] = state;
+    const cjson_query *query = stream->query;
+    if (state % 2 == 0 && state / 2 < query->size
+            && query->code[state / 2].op == CJSON_QUERY_DESCENDANTS)
+        cjson_stream_add(stream, state + 2);
 }
 
-void cjson_parse_members(cjson_lexer *lexer, cjson_map *map, int *error)
+/**
+ * @brief returns true if instruction can only be applied with the value it
+ *        applies to built
+ */
+static bool cjson_stream_needs_value(const cjson_query_instruction *instruction)
 {
-    cjson_parse_member(lexer, map, error);
-    while (!*error && cjson_lexer_peek(lexer).type == CJSON_TOK_COMMA)
+    switch (instruction->op)
     {
-        cjson_lexer_pop(lexer);
-        cjson_parse_member(lexer, map, error);
+    case CJSON_QUERY_INDEX:
+        return instruction->start < 0;
+    case CJSON_QUERY_SLICE:
+        return instruction->step <= 0 || (instruction->has_start && instruction->start < 0)
+            || (instruction->has_end && instruction->end < 0);
+    default:
+        return false;
     }
 }
 
-cjson_element *cjson_parse_object(cjson_lexer *lexer, int *error)
+/**
+ * @brief returns true if state goes on to the children of the value it is
+ *        the state of from their key or index alone
+ */
+static bool cjson_stream_walks(const cjson_stream *stream, size_t state)
 {
-    // Clear '{'
-    cjson_lexer_pop(lexer);
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_OBJECT;
-    res->value.object.members.capacity = 64;
-    res->value.object.members.items = calloc(64, sizeof(cjson_map_item *));
+    const cjson_query *query = stream->query;
+    return state % 2 == 0 && state / 2 < query->size
+        && !cjson_stream_needs_value(&query->code[state / 2]);
+}
 
-    cjson_parse_ws(lexer);
-    cjson_token token = cjson_lexer_peek(lexer);
-    if (!*error && token.type != CJSON_TOK_RBRACE)
-        cjson_parse_members(lexer, &res->value.object.members, error);
-    token = cjson_lexer_pop(lexer);
-    if (token.type != CJSON_TOK_RBRACE)
+/**
+ * @brief sets the states of the child of the innermost container starting,
+ *        with its key if it is a member or index if it is an element
+ */
+static void cjson_stream_child(cjson_stream *stream, const char *key, size_t key_len,
+        size_t index)
+{
+    const cjson_query *query = stream->query;
+    const cjson_stream_frame *frame = &stream->frames[stream->frames_size - 1];
+    stream->value_first = stream->states_size;
+    for (size_t i = frame->first; i < frame->first + frame->size; i++)
     {
-        cjson_delete(res);
-        return NULL;
+        size_t pc = stream->states[i] / 2;
+        // Only built containers have the other states, walked separately
+        if (!cjson_stream_walks(stream, stream->states[i]))
+            continue;
+        const cjson_query_instruction *instruction = &query->code[pc];
+        switch (instruction->op)
+        {
+        case CJSON_QUERY_MEMBER:
+            if (key != NULL && instruction->member_len == key_len
+                    && memcmp(instruction->member.name, key, key_len) == 0)
+                cjson_stream_add(stream, (pc + 1) * 2);
+            break;
+        case CJSON_QUERY_INDEX:
+            if (key == NULL && (int64_t)index == instruction->start)
+                cjson_stream_add(stream, (pc + 1) * 2);
+            break;
+        case CJSON_QUERY_SLICE:
+        {
+            int64_t start = instruction->has_start ? instruction->start : 0;
+            if (key == NULL && (int64_t)index >= start
+                    && (!instruction->has_end || (int64_t)index < instruction->end)
+                    && ((int64_t)index - start) % instruction->step == 0)
+                cjson_stream_add(stream, (pc + 1) * 2);
+            break;
+        }
+        case CJSON_QUERY_WILDCARD:
+            cjson_stream_add(stream, (pc + 1) * 2);
+            break;
+        case CJSON_QUERY_DESCENDANTS:
+            cjson_stream_add(stream, pc * 2);
+            break;
+        case CJSON_QUERY_FILTER:
+            cjson_stream_add(stream, pc * 2 + 1);
+            break;
+        }
     }
-    return res;
 }
 
-cjson_element *cjson_parse_array(cjson_lexer *lexer, int *error)
+/**
+ * @brief decides what becomes of the value starting from its states
+ */
+static int cjson_stream_start(cjson_stream *stream)
 {
-    cjson_lexer_pop(lexer);
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_ARRAY;
-    cjson_parse_ws(lexer);
-    if (!*error && cjson_lexer_peek(lexer).type != CJSON_TOK_RBRACK)
+    if (stream->frames_size > 0 && !stream->frames[stream->frames_size - 1].object)
+        cjson_stream_child(stream, NULL, 0, stream->frames[stream->frames_size - 1].index++);
+    if (stream->value_first == stream->states_size)
+        return CJSON_STREAM_SKIP;
+    for (size_t i = stream->value_first; i < stream->states_size; i++)
     {
-        cjson_element *elt = cjson_parse_element(lexer, error);
-        cjson_array_append(&res->value.array, elt);
-        while (!*error && cjson_lexer_peek(lexer).type == CJSON_TOK_COMMA)
-        {
-            cjson_lexer_pop(lexer);
-            elt = cjson_parse_element(lexer, error);
-            cjson_array_append(&res->value.array, elt);
-        }
-        if (cjson_lexer_peek(lexer).type != CJSON_TOK_RBRACK)
+        if (!cjson_stream_walks(stream, stream->states[i]))
         {
-            cjson_delete(res);
-            return NULL;
+            stream->building = true;
+            return CJSON_STREAM_BUILD;
         }
     }
-    cjson_lexer_pop(lexer);
+    return CJSON_STREAM_ENTER;
+}
+
+/**
+ * @brief gives callback the results of the instructions from pc on over
+ *        value, returns false if it stopped
+ */
+static bool cjson_stream_finish(cjson_stream *stream, size_t pc, cjson_element *value)
+{
+    const cjson_query *query = stream->query;
+    cjson_query rest = { .code = query->code + pc, .size = query->size - pc };
+    cjson_query_iterator *iterator = cjson_query_run(&rest, value);
+    cjson_element *result;
+    bool res = true;
+    while (res && (result = cjson_query_next(iterator)) != NULL)
+        res = stream->callback(stream->ctx, result);
+    cjson_query_iterator_delete(iterator);
     return res;
 }
 
-cjson_element *cjson_parse_value(cjson_lexer *lexer, int *error)
+static void cjson_stream_push_frame(cjson_stream *stream, bool object)
 {
-    cjson_token token = cjson_lexer_peek(lexer);
-    cjson_element *res = NULL;
-    switch (token.type)
+    if (stream->frames_size == stream->frames_capacity)
     {
-    case CJSON_TOK_LBRACE:
-        res = cjson_parse_object(lexer, error);
-        break;
-    case CJSON_TOK_LBRACK:
-        res = cjson_parse_array(lexer, error);
-        break;
-    case CJSON_TOK_STRING:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_STRING;
-        res->value.string.value = cjson_extract_string(&token);
-        cjson_lexer_pop(lexer);
-        break;
-    case CJSON_TOK_INTEGER:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_INTEGER;
-        res->value.integer.value = token.integer_value;
-        cjson_lexer_pop(lexer);
-        break;
-    case CJSON_TOK_FLOAT:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_INTEGER;
-        res->value.fraction.value = token.float_value;
-        cjson_lexer_pop(lexer);
-        break;
-    case CJSON_TOK_TRUE:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_BOOL;
-        res->value.boolean.value = true;
-        cjson_lexer_pop(lexer);
-        break;
-    case CJSON_TOK_FALSE:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_BOOL;
-        res->value.boolean.value = false;
-        cjson_lexer_pop(lexer);
-        break;
-    case CJSON_TOK_NULL:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_NULL;
-        cjson_lexer_pop(lexer);
-        break;
+        stream->frames_capacity = stream->frames_capacity == 0 ? 16 : stream->frames_capacity * 2;
+        stream->frames = realloc(stream->frames, stream->frames_capacity * sizeof(cjson_stream_frame));
     }
-    return res;
+    stream->frames[stream->frames_size++] = (cjson_stream_frame){
+        .first = stream->value_first,
+        .size = stream->states_size - stream->value_first,
+        .object = object,
+        .index = 0,
+    };
 }
 
-cjson_element *cjson_parse_element(cjson_lexer *lexer, int *error)
+/**
+ * @brief gives callback the results of the query in a built value from its
+ *        states: the value itself, then those of the instructions finished by
+ *        an iterator, then those in its children. returns false if callback
+ *        stopped
+ */
+static bool cjson_stream_walk(cjson_stream *stream, cjson_element *value)
 {
-    cjson_parse_ws(lexer);
-    cjson_element *value = cjson_parse_value(lexer, error);
-    cjson_parse_ws(lexer);
-    return value;
+    const cjson_query *query = stream->query;
+    bool itself = false;
+    bool walks = false;
+    for (size_t i = stream->value_first; i < stream->states_size; i++)
+    {
+        size_t state = stream->states[i];
+        if (state % 2 == 1)
+            itself |= state / 2 + 1 == query->size && cjson_query_test(&query->code[state / 2], value);
+        else
+            itself |= state / 2 == query->size;
+        walks |= cjson_stream_walks(stream, state);
+    }
+    if (itself && !stream->callback(stream->ctx, value))
+        return false;
+    for (size_t i = stream->value_first; i < stream->states_size; i++)
+    {
+        size_t state = stream->states[i];
+        size_t pc = state / 2;
+        if (state % 2 == 1 && pc + 1 < query->size && cjson_query_test(&query->code[pc], value))
+            pc++;
+        else if (state % 2 == 1 || pc == query->size || cjson_stream_walks(stream, state))
+            continue;
+        if (!cjson_stream_finish(stream, pc, value))
+            return false;
+    }
+    size_t children = cjson_query_children(value);
+    if (!walks || children == 0)
+        return true;
+    bool object = value->element_type == CJSON_OBJECT;
+    cjson_stream_push_frame(stream, object);
+    bool res = true;
+    for (size_t i = 0; i < children && res; i++)
+    {
+        if (object)
+        {
+            const char *name = value->value.object.members.items[i].name;
+            cjson_stream_child(stream, name, strlen(name), 0);
+        }
+        else
+            cjson_stream_child(stream, NULL, 0, i);
+        if (stream->value_first < stream->states_size)
+            res = cjson_stream_walk(stream, cjson_query_child(value, i));
+        stream->states_size = stream->value_first;
+    }
+    // The states of value are left as they were
+    const cjson_stream_frame *frame = &stream->frames[--stream->frames_size];
+    stream->value_first = frame->first;
+    stream->states_size = frame->first + frame->size;
+    return res;
 }
 
-cjson_element *cjson_parse_str(char *str)
+/**
+ * @brief finishes the query over the value the builder completed, if any
+ */
+static bool cjson_stream_built(cjson_stream *stream)
 {
-    int error = 0;
+    if (stream->dom.frames_size > 0)
+        return true;
+    cjson_element *value = stream->dom.root;
+    stream->dom.root = NULL;
+    stream->building = false;
+    stream->stopped = !cjson_stream_walk(stream, value);
+    cjson_delete(value);
+    stream->states_size = stream->value_first;
+    return !stream->stopped;
+}
 
-    cjson_lexer lexer = { .content = str };
-    cjson_element *res = cjson_parse_element(&lexer, &error);
-    if (error)
-        return NULL;
-    return res;
-};
+/**
+ * @brief returns true if the scalar starting is built
+ */
+static bool cjson_stream_scalar(cjson_stream *stream)
+{
+    if (stream->building || cjson_stream_start(stream) == CJSON_STREAM_BUILD)
+        return true;
+    stream->states_size = stream->value_first;
+    return false;
+}
 
+/**
+ * @brief handles the start of a container: returns false to have it skipped,
+ *        true to go on, building it if its states need it
+ */
+static bool cjson_stream_open(cjson_stream *stream, bool object)
+{
+    if (stream->building)
+        return true;
+    switch (cjson_stream_start(stream))
+    {
+    case CJSON_STREAM_SKIP:
+        return false;
+    case CJSON_STREAM_BUILD:
+        return true;
+    }
+    cjson_stream_push_frame(stream, object);
+    return true;
+}
 
-bool cjson_as_bool(cjson_element *element)
+/**
+ * @brief leaves the innermost container walked, dropping its states
+ */
+static bool cjson_stream_close(cjson_stream *stream)
 {
-    assert(cjson_is_bool(element));
-    return element->value.boolean.value;
+    stream->states_size = stream->frames[--stream->frames_size].first;
+    stream->value_first = stream->states_size;
+    return true;
 }
 
-bool cjson_is_bool(cjson_element *element)
+static bool cjson_stream_null(void *ctx)
 {
-    return element->element_type == CJSON_BOOL;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_null(&stream->dom) && cjson_stream_built(stream);
 }
 
-cjson_element *cjson_create_bool(bool value)
+static bool cjson_stream_boolean(void *ctx, bool value)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_BOOL;
-    res->value.boolean.value = value;
-    return res;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_boolean(&stream->dom, value) && cjson_stream_built(stream);
 }
 
-int cjson_as_integer(cjson_element *element)
+static bool cjson_stream_integer(void *ctx, int64_t value)
 {
-    assert(cjson_is_integer(element));
-    return element->value.integer.value;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_integer(&stream->dom, value) && cjson_stream_built(stream);
 }
 
-bool cjson_is_integer(cjson_element *element)
+static bool cjson_stream_unsigned_integer(void *ctx, uint64_t value)
 {
-    return element->element_type == CJSON_INTEGER;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_unsigned_integer(&stream->dom, value) && cjson_stream_built(stream);
 }
 
-cjson_element *cjson_create_integer(int value)
+static bool cjson_stream_fraction(void *ctx, double value)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_INTEGER;
-    res->value.integer.value = value;
-    return res;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_fraction(&stream->dom, value) && cjson_stream_built(stream);
 }
 
-double cjson_as_float(cjson_element *element)
+static bool cjson_stream_string(void *ctx, const char *str, size_t len)
 {
-    assert(cjson_is_float(element));
-    return element->value.fraction.value;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_scalar(stream))
+        return true;
+    return cjson_dom_string(&stream->dom, str, len) && cjson_stream_built(stream);
 }
 
-bool cjson_is_float(cjson_element *element)
+static bool cjson_stream_start_object(void *ctx)
 {
-    return element->element_type == CJSON_FLOAT;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_open(stream, true))
+        return false;
+    return !stream->building || cjson_dom_start_object(&stream->dom);
 }
 
-cjson_element *cjson_create_float(double value)
+static bool cjson_stream_key(void *ctx, const char *str, size_t len)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_FLOAT;
-    res->value.fraction.value = value;
-    return res;
+    cjson_stream *stream = ctx;
+    if (stream->building)
+        return cjson_dom_key(&stream->dom, str, len);
+    cjson_stream_child(stream, str, len, 0);
+    return true;
 }
 
-char *cjson_as_string(cjson_element *element)
+static bool cjson_stream_end_object(void *ctx)
 {
-    assert(cjson_is_string(element));
-    return element->value.string.value;
+    cjson_stream *stream = ctx;
+    if (stream->building)
+        return cjson_dom_end_object(&stream->dom) && cjson_stream_built(stream);
+    return cjson_stream_close(stream);
 }
 
-bool cjson_is_string(cjson_element *element)
+static bool cjson_stream_start_array(void *ctx)
 {
-    return element->element_type == CJSON_STRING;
+    cjson_stream *stream = ctx;
+    if (!cjson_stream_open(stream, false))
+        return false;
+    return !stream->building || cjson_dom_start_array(&stream->dom);
 }
 
-cjson_element *cjson_create_string(char *value)
+static bool cjson_stream_end_array(void *ctx)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_STRING;
-    res->value.string.value = strdup(value);
-    return res;
+    cjson_stream *stream = ctx;
+    if (stream->building)
+        return cjson_dom_end_array(&stream->dom) && cjson_stream_built(stream);
+    return cjson_stream_close(stream);
 }
 
-void cjson_array_append(cjson_array *array, cjson_element *element)
+static const cjson_handler cjson_stream_handler = {
+    .null = cjson_stream_null,
+    .boolean = cjson_stream_boolean,
+    .integer = cjson_stream_integer,
+    .unsigned_integer = cjson_stream_unsigned_integer,
+    .fraction = cjson_stream_fraction,
+    .string = cjson_stream_string,
+    .start_object = cjson_stream_start_object,
+    .key = cjson_stream_key,
+    .end_object = cjson_stream_end_object,
+    .start_array = cjson_stream_start_array,
+    .end_array = cjson_stream_end_array,
+};
+
+int cjson_query_stream(const cjson_query *query, const char *buf, size_t len,
+        cjson_query_callback callback, void *ctx)
 {
-    if (array->capacity == 0)
+    cjson_stream stream;
+    memset(&stream, 0, sizeof(cjson_stream));
+    stream.query = query;
+    stream.callback = callback;
+    stream.ctx = ctx;
+    cjson_stream_add(&stream, 0);
+    cjson_dom_init(&stream.dom, NULL, false);
+    cjson_lexer lexer;
+    cjson_lexer_init(&lexer, buf, len, true);
+    cjson_lexer_options(&lexer, &cjson_default_parse_options);
+    int status;
+    // Past callback stopping, the handler only stops on containers to skip
+    while ((status = cjson_lexer_parse(&lexer, &cjson_stream_handler, &stream))
+            == CJSON_PARSE_STOPPED && !stream.stopped)
     {
-        array->capacity = 8;
-        array->elements = malloc(array->capacity * sizeof(cjson_element *));
+        stream.states_size = stream.value_first;
+        if (!cjson_lexer_skip_container(&lexer))
+        {
+            status = CJSON_PARSE_ERROR;
+            break;
+        }
     }
-    if (array->size == array->capacity)
+    cjson_dom_release(&stream.dom);
+    cjson_delete(stream.dom.root);
+    cjson_lexer_release(&lexer);
+    free(stream.states);
+    free(stream.frames);
+    return status == CJSON_PARSE_DONE ? 0 : -1;
+}
+
+/**
+ * @brief moves the iterator to the member inserted at position i
+ */
+static void cjson_iterate_seek(cjson_object_iterator *iterator, size_t i)
+{
+    cjson_map *map = iterator->map;
+    iterator->i = i;
+    iterator->end = i >= map->size;
+    if (!iterator->end)
     {
-        array->capacity *= 2;
-        array->elements = realloc(array->elements, array->capacity * sizeof(cjson_element *));
+        iterator->name = map->items[i].name;
+        iterator->element = map->items[i].element;
     }
-    array->elements[array->size++] = element;
 }
 
-void cjson_array_insert(cjson_array *array, cjson_element *element, size_t index)
+cjson_object_iterator cjson_iterate_object(cjson_object *obj)
 {
-    cjson_array_append(array, element);
-    size_t current = array->size - 1;
-    while (current > index)
+    cjson_object_iterator res = {
+        .map = &obj->members,
+        .end = true,
+    };
+    cjson_iterate_seek(&res, 0);
+    return res;
+}
+
+cjson_object_iterator cjson_iterate_next(cjson_object_iterator *iterator)
+{
+    if (!iterator->end)
+        cjson_iterate_seek(iterator, iterator->i + 1);
+    return *iterator;
+}
+
+/*
+ * Number formatting. Integers are written two digits at a time from a table
+ * of digit pairs. Doubles are written with the Grisu2 algorithm, which finds
+ * a short digit string that reads back as the same double, almost always
+ * the shortest one, and then laid out like JavaScript numbers with a
+ * trailing ".0" so they read back as floats.
+ */
+
+// enough for any number written by cjson_format_*
+#define CJSON_NUMBER_MAX 32
+
+static const char cjson_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * @brief writes the decimal digits of value to out, returns their number
+ */
+static size_t cjson_format_uint64(uint64_t value, char *out)
+{
+    char buffer[20];
+    char *p = buffer + sizeof(buffer);
+    while (value >= 100)
     {
-        cjson_element *tmp = array->elements[current - 1];
-        array->elements[current - 1] = array->elements[current];
-        array->elements[current] = tmp;
-        current -= 1;
+        p -= 2;
+        memcpy(p, cjson_digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10)
+    {
+        p -= 2;
+        memcpy(p, cjson_digit_pairs + value * 2, 2);
     }
+    else
+        *--p = '0' + value;
+    size_t len = buffer + sizeof(buffer) - p;
+    memcpy(out, p, len);
+    return len;
 }
 
-cjson_array *cjson_as_array(cjson_element *element)
+static size_t cjson_format_int64(int64_t value, char *out)
 {
-    assert(cjson_is_array(element));
-    return &element->value.array;
+    if (value >= 0)
+        return cjson_format_uint64(value, out);
+    *out = '-';
+    return 1 + cjson_format_uint64(0 - (uint64_t)value, out + 1);
 }
 
-cjson_element *cjson_create_array()
+// Normalized 64-bit approximations of 10^k, for k from -348 to 340 by 8
+static const uint64_t cjson_cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t cjson_cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t cjson_powers_of_ten[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+// f * 2^e
+typedef struct
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_ARRAY;
+    uint64_t f;
+    int e;
+} cjson_diy_fp;
+
+static cjson_diy_fp cjson_diy_fp_multiply(cjson_diy_fp a, cjson_diy_fp b)
+{
+    uint64_t low = a.f;
+    uint64_t high = b.f;
+    cjson_mum(&low, &high);
+    // Rounded to the nearest
+    high += low >> 63;
+    cjson_diy_fp res = { .f = high, .e = a.e + b.e + 64 };
     return res;
 }
 
-bool cjson_is_array(cjson_element *element)
+static cjson_diy_fp cjson_diy_fp_normalize(cjson_diy_fp a)
+{
+    int shift = __builtin_clzll(a.f);
+    cjson_diy_fp res = { .f = a.f << shift, .e = a.e - shift };
+    return res;
+}
+
+static void cjson_grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest,
+        uint64_t ten_kappa, uint64_t wp_w)
+{
+    // Move the last digit towards the exact value while staying in range
+    while (rest < wp_w && delta - rest >= ten_kappa
+            && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buffer[len - 1] -= 1;
+        rest += ten_kappa;
+    }
+}
+
+/**
+ * @brief generates the digits of a value within delta below mp into buffer,
+ *        adjusting the decimal exponent k
+ */
+static int cjson_grisu_digits(cjson_diy_fp w, cjson_diy_fp mp, uint64_t delta,
+        char *buffer, int *k)
 {
-    return element->element_type == CJSON_ARRAY;
+    uint64_t one = 1ULL << -mp.e;
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = mp.f >> -mp.e;
+    uint64_t p2 = mp.f & (one - 1);
+    int len = 0;
+    int kappa = 10;
+    while (kappa > 0 && p1 < cjson_powers_of_ten[kappa - 1])
+        kappa -= 1;
+
+    while (kappa > 0)
+    {
+        uint32_t divisor = cjson_powers_of_ten[kappa - 1];
+        uint32_t d = p1 / divisor;
+        p1 %= divisor;
+        if (d != 0 || len != 0)
+            buffer[len++] = '0' + d;
+        kappa -= 1;
+        uint64_t rest = ((uint64_t)p1 << -mp.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            cjson_grisu_round(buffer, len, delta, rest,
+                    cjson_powers_of_ten[kappa] << -mp.e, wp_w);
+            return len;
+        }
+    }
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = p2 >> -mp.e;
+        if (d != 0 || len != 0)
+            buffer[len++] = '0' + d;
+        p2 &= one - 1;
+        kappa -= 1;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            cjson_grisu_round(buffer, len, delta, p2, one,
+                    -kappa < 20 ? wp_w * cjson_powers_of_ten[-kappa] : 0);
+            return len;
+        }
+    }
 }
 
-cjson_element *cjson_object_get(cjson_object *object, char *name)
+/**
+ * @brief writes the digits of a positive double to buffer, returns their
+ *        number and sets k so the value is digits * 10^k
+ */
+static int cjson_grisu2(double value, char *buffer, int *k)
 {
-    size_t h = cjson_hash(name) % object->members.capacity;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    int biased_e = (bits >> 52) & 0x7FF;
+    uint64_t significand = bits & ((1ULL << 52) - 1);
+    cjson_diy_fp v;
+    if (biased_e != 0)
+    {
+        v.f = significand | (1ULL << 52);
+        v.e = biased_e - 1075;
+    }
+    else
+    {
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    // Boundaries halfway to the neighbouring doubles, with the same exponent
+    cjson_diy_fp plus = { .f = (v.f << 1) + 1, .e = v.e - 1 };
+    plus = cjson_diy_fp_normalize(plus);
+    cjson_diy_fp minus;
+    if (v.f == 1ULL << 52)
+    {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+    else
+    {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
 
-    cjson_map_item *item = object->members.items[h];
-    while (item != NULL && strcmp(item->name, name))
-        item = item->next;
+    // Cached power of ten bringing the exponent of plus in [-60, -32]
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0)
+        ik += 1;
+    unsigned index = (ik >> 3) + 1;
+    *k = -(-348 + (int)(index << 3));
+    cjson_diy_fp c_mk = {
+        .f = cjson_cached_powers_f[index],
+        .e = cjson_cached_powers_e[index],
+    };
 
-    if (item != NULL)
-        return item->element;
-    return NULL;
+    cjson_diy_fp w = cjson_diy_fp_multiply(cjson_diy_fp_normalize(v), c_mk);
+    cjson_diy_fp wp = cjson_diy_fp_multiply(plus, c_mk);
+    cjson_diy_fp wm = cjson_diy_fp_multiply(minus, c_mk);
+    wm.f += 1;
+    wp.f -= 1;
+    return cjson_grisu_digits(w, wp, wp.f - wm.f, buffer, k);
 }
 
-void cjson_object_insert(cjson_object *object, char *name, cjson_element *value)
+static char *cjson_write_exponent(int k, char *out)
 {
-    cjson_map_insert(&object->members, name, value);
+    if (k < 0)
+    {
+        *out++ = '-';
+        k = -k;
+    }
+    if (k >= 100)
+    {
+        *out++ = '0' + k / 100;
+        k %= 100;
+        memcpy(out, cjson_digit_pairs + k * 2, 2);
+        return out + 2;
+    }
+    if (k >= 10)
+    {
+        memcpy(out, cjson_digit_pairs + k * 2, 2);
+        return out + 2;
+    }
+    *out++ = '0' + k;
+    return out;
 }
 
-cjson_object *cjson_as_object(cjson_element *element)
+/**
+ * @brief writes value to out, null if it is not finite, returns the number
+ *        of characters written
+ */
+static size_t cjson_format_double(double value, char *out)
 {
-    assert(element->element_type == CJSON_OBJECT);
-    return &element->value.object;
+    char *start = out;
+    if (isnan(value) || isinf(value))
+    {
+        memcpy(out, "null", 4);
+        return 4;
+    }
+    if (signbit(value))
+    {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value == 0)
+    {
+        memcpy(out, "0.0", 3);
+        return out + 3 - start;
+    }
+
+    int k;
+    int len = cjson_grisu2(value, out, &k);
+    // The value is between 10^(kk - 1) and 10^kk
+    int kk = len + k;
+    if (k >= 0 && kk <= 21)
+    {
+        // 1234e7 -> 12340000000.0
+        memset(out + len, '0', kk - len);
+        memcpy(out + kk, ".0", 2);
+        out += kk + 2;
+    }
+    else if (kk > 0 && kk <= 21)
+    {
+        // 1234e-2 -> 12.34
+        memmove(out + kk + 1, out + kk, len - kk);
+        out[kk] = '.';
+        out += len + 1;
+    }
+    else if (kk > -6 && kk <= 0)
+    {
+        // 1234e-6 -> 0.001234
+        int offset = 2 - kk;
+        memmove(out + offset, out, len);
+        memcpy(out, "0.", 2);
+        memset(out + 2, '0', offset - 2);
+        out += len + offset;
+    }
+    else if (len == 1)
+    {
+        // 1e30
+        out[1] = 'e';
+        out = cjson_write_exponent(kk - 1, out + 2);
+    }
+    else
+    {
+        // 1234e30 -> 1.234e33
+        memmove(out + 2, out + 1, len - 1);
+        out[1] = '.';
+        out[len + 1] = 'e';
+        out = cjson_write_exponent(kk - 1, out + len + 2);
+    }
+    return out - start;
 }
 
-bool cjson_is_object(cjson_element *element)
+/*
+ * Every serializer writes through a sink. A sink with no buffer only counts
+ * bytes; otherwise it writes them, flushing or growing the buffer when full,
+ * or keeping only what fits when there is no flush. Either way its total
+ * counts every byte written to it.
+ */
+typedef struct cjson_sink
 {
-    return element->element_type == CJSON_OBJECT;
-}
+    char *buffer;
+    size_t capacity;
+    size_t used;
+    size_t total;
+    // makes room in the buffer, NULL to drop what does not fit
+    void (*flush)(struct cjson_sink *sink);
+    // writes data that stays valid until the output is done without copying
+    // it, NULL to copy it like any other data
+    void (*reference)(struct cjson_sink *sink, const char *data, size_t len);
+} cjson_sink;
 
-cjson_element *cjson_create_object(size_t capacity)
+static void cjson_sink_overflow(cjson_sink *sink, const char *data, size_t len)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_OBJECT;
-    res->value.object.members.capacity = capacity;
-    res->value.object.members.items = calloc(capacity, sizeof(cjson_map_item *));
-    return res;
+    while (len > sink->capacity - sink->used)
+    {
+        size_t room = sink->capacity - sink->used;
+        if (sink->buffer != NULL)
+            memcpy(sink->buffer + sink->used, data, room);
+        sink->used += room;
+        if (sink->flush == NULL)
+            return;
+        sink->flush(sink);
+        data += room;
+        len -= room;
+    }
+    if (sink->buffer != NULL)
+        memcpy(sink->buffer + sink->used, data, len);
+    sink->used += len;
 }
 
-void *cjson_as_null(cjson_element *element)
+static inline void cjson_sink_write(cjson_sink *sink, const char *data, size_t len)
 {
-    assert(cjson_is_null(element));
-    return NULL;
+    sink->total += len;
+    if (sink->buffer == NULL)
+        return;
+    if (len <= sink->capacity - sink->used)
+    {
+        memcpy(sink->buffer + sink->used, data, len);
+        sink->used += len;
+    }
+    else
+        cjson_sink_overflow(sink, data, len);
 }
 
-bool cjson_is_null(cjson_element *element)
+static inline void cjson_sink_reference(cjson_sink *sink, const char *data, size_t len)
 {
-    return element->element_type == CJSON_NULL;
+    if (sink->reference != NULL)
+        sink->reference(sink, data, len);
+    else
+        cjson_sink_write(sink, data, len);
 }
 
-cjson_element *cjson_create_null()
+static void cjson_sink_newline(cjson_sink *sink, int pretty, size_t indent)
 {
-    cjson_element *res = calloc(1, sizeof(cjson_element));
-    res->element_type = CJSON_NULL;
-    return res;
+    static const char spaces[] = "                                ";
+    if (!pretty)
+        return;
+    cjson_sink_write(sink, "\n", 1);
+    for (; indent > sizeof(spaces) - 1; indent -= sizeof(spaces) - 1)
+        cjson_sink_write(sink, spaces, sizeof(spaces) - 1);
+    cjson_sink_write(sink, spaces, indent);
 }
 
-cjson_element *cjson_get_element_from_object(cjson_element *element, char *from)
+/**
+ * @brief whether the byte has to be escaped in a JSON string: quotes,
+ *        backslashes and control characters
+ */
+static inline bool cjson_needs_escape(unsigned char c)
 {
-    assert(cjson_is_object(element));
-    assert((isalpha(from[1]) || from[1] == '_') && "invalid member name");
-    cjson_object *object = cjson_as_object(element);
-    size_t name_len = strspn(
-            from + 1,
-            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789");
-    char *name = strndup(from + 1, name_len);
-    cjson_element *elt_at_name = cjson_object_get(object, name);
-    assert(elt_at_name && "object does not contain member");
-    free(name);
-    if (from[name_len + 1] == '\0')
-        return elt_at_name;
-    return cjson_get_element_from(elt_at_name, from + name_len + 1);
+    return c < 0x20 || c == '"' || c == '\\';
 }
 
-cjson_element *cjson_get_element_from_array(cjson_element *element, char *from)
+static size_t cjson_find_escape_scalar(const unsigned char *str, size_t len)
 {
-    assert(cjson_is_array(element));
-    cjson_array *array = cjson_as_array(element);
-    char *endptr = NULL;
-    size_t i = strtoul(from + 1, &endptr, 10);
-    assert(*endptr == ']' && "invalid syntax when indexing");
-    cjson_element *elt_at_i = array->elements[i];
-    if (endptr[1] == '\0')
-        return elt_at_i;
-    return cjson_get_element_from(elt_at_i, endptr + 1);
+    size_t i = 0;
+    while (i < len && !cjson_needs_escape(str[i]))
+        i++;
+    return i;
 }
 
-cjson_element *cjson_get_element_from(cjson_element *element, char *from)
+#ifdef CJSON_X86
+
+__attribute__((target("sse4.2")))
+static size_t cjson_find_escape_sse42(const unsigned char *str, size_t len)
 {
-    if (*from == '[')
-        return cjson_get_element_from_array(element, from);
-    else if (*from == '.')
-        return cjson_get_element_from_object(element, from);
-    assert(0 && "invalid syntax when getting from string path");
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(str + i));
+        // c <= 0x1f as unsigned bytes
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8(0x1f)), in);
+        __m128i escape = _mm_or_si128(control,
+                _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+                             _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))));
+        unsigned mask = _mm_movemask_epi8(escape);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + cjson_find_escape_scalar(str + i, len - i);
 }
 
-cjson_object_iterator cjson_iterate_object(cjson_object *obj)
+__attribute__((target("avx2")))
+static size_t cjson_find_escape_avx2(const unsigned char *str, size_t len)
 {
-    cjson_map_item *first = NULL;
     size_t i = 0;
-    for (; i < obj->members.capacity; i++)
+    for (; i + 32 <= len; i += 32)
     {
-        first = obj->members.items[i];
-        if (first != NULL)
-            break;
+        __m256i in = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i control = _mm256_cmpeq_epi8(
+                _mm256_min_epu8(in, _mm256_set1_epi8(0x1f)), in);
+        __m256i escape = _mm256_or_si256(control,
+                _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')),
+                                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))));
+        unsigned mask = _mm256_movemask_epi8(escape);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
     }
-    cjson_object_iterator res = {
-        .map = &obj->members,
-        .i = i,
-        .end = true,
-        .item = NULL,
-    };
-    if (first != NULL)
+    // Calling the SSE version for the tail would run legacy SSE code with
+    // dirty AVX registers, which stalls, so its 16 bytes step is inlined
+    if (i + 16 <= len)
     {
-        res.element = first->element;
-        res.name = first->name;
-        res.end = false;
-        res.i = i;
-        res.item = first;
+        __m128i in = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8(0x1f)), in);
+        __m128i escape = _mm_or_si128(control,
+                _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+                             _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))));
+        unsigned mask = _mm_movemask_epi8(escape);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
     }
-    return res;
+    return i + cjson_find_escape_scalar(str + i, len - i);
 }
 
-cjson_object_iterator cjson_iterate_next(cjson_object_iterator *iterator)
+#endif /* CJSON_X86 */
+
+/**
+ * @brief returns the position of the first byte of str to escape, len if
+ *        there is none
+ */
+static size_t cjson_find_escape(const char *str, size_t len)
 {
-    if (iterator->end)
-        return *iterator;
-    if (iterator->item->next != NULL)
+    const unsigned char *input = (const unsigned char *)str;
+    switch (cjson_simd_level())
     {
-        iterator->item = iterator->item->next;
-        iterator->name = iterator->item->name;
-        iterator->element = iterator->item->element;
+#ifdef CJSON_X86
+    case CJSON_SIMD_AVX2:
+        return cjson_find_escape_avx2(input, len);
+    case CJSON_SIMD_SSE42:
+        return cjson_find_escape_sse42(input, len);
+#endif /* CJSON_X86 */
+    default:
+        return cjson_find_escape_scalar(input, len);
     }
-    else 
+}
+
+/**
+ * @brief writes str as a quoted JSON string, the runs between escapes are
+ *        passed by reference
+ */
+static void cjson_sink_string(cjson_sink *sink, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strlen(str);
+    cjson_sink_write(sink, "\"", 1);
+    while (len > 0)
     {
-        for (iterator->i += 1; iterator->i < iterator->map->capacity; iterator->i++)
+        size_t clean = cjson_find_escape(str, len);
+        if (clean > 0)
+            cjson_sink_reference(sink, str, clean);
+        if (clean == len)
+            break;
+
+        unsigned char c = str[clean];
+        char escape[6] = { '\\', c };
+        size_t escape_len = 2;
+        switch (c)
         {
-            if (iterator->map->items[iterator->i])
-            {
-                iterator->item = iterator->map->items[iterator->i];
-                iterator->name = iterator->item->name;
-                iterator->element = iterator->item->element;
-                break;
-            }
+        case '"': case '\\':
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0xf];
+            escape_len = 6;
+            break;
         }
+        cjson_sink_write(sink, escape, escape_len);
+        str += clean + 1;
+        len -= clean + 1;
     }
-    if (iterator->i == iterator->map->capacity)
-        iterator->end = true;
-    return *iterator;
+    cjson_sink_write(sink, "\"", 1);
 }
 
-void cjson_pretty_newline(int pretty, int indent)
+static void cjson_serialize(cjson_sink *sink, cjson_element *element, int pretty,
+        size_t indent)
 {
-    assert(indent >= 0);
-    if (pretty)
-        printf("\n%*s", indent, "");
-}
-
-void cjson_to_str_rec(cjson_element *element, int pretty, cjson_str_builder *sb)
-{
-    static size_t indent = 0;
-    char buffer[11];
+    char buffer[CJSON_NUMBER_MAX];
     switch (element->element_type)
     {
     case CJSON_NULL:
-        cjson_str_builder_append_cstr(sb, "null");
+        cjson_sink_write(sink, "null", 4);
         break;
     case CJSON_BOOL:
         if (element->value.boolean.value)
-            cjson_str_builder_append_cstr(sb, "true");
+            cjson_sink_write(sink, "true", 4);
         else
-            cjson_str_builder_append_cstr(sb, "false");
+            cjson_sink_write(sink, "false", 5);
         break;
     case CJSON_INTEGER:
-        sprintf(buffer, "%d", element->value.integer.value);
-        cjson_str_builder_append_cstr(sb, buffer);
+        cjson_sink_write(sink, buffer, cjson_format_int64(element->value.integer.value, buffer));
+        break;
+    case CJSON_UNSIGNED:
+        cjson_sink_write(sink, buffer,
+                cjson_format_uint64(element->value.unsigned_integer.value, buffer));
         break;
     case CJSON_FLOAT:
-        sprintf(buffer, "%lf", element->value.fraction.value);
-        cjson_str_builder_append_cstr(sb, buffer);
+        cjson_sink_write(sink, buffer, cjson_format_double(element->value.fraction.value, buffer));
         break;
     case CJSON_STRING:
-        cjson_str_builder_append_char(sb, '"');
-        cjson_str_builder_append_cstr(sb, element->value.string.value);
-        cjson_str_builder_append_char(sb, '"');
+        cjson_sink_string(sink, element->value.string.value);
         break;
     case CJSON_ARRAY:
-        cjson_str_builder_append_char(sb, '[');
-        indent += 2;
-        if (pretty)
-        {
-            cjson_str_builder_append_char(sb, '\n');
-            for (size_t i = 0; i < indent; i++)
-                cjson_str_builder_append_char(sb, ' ');
-        }
-        if (element->value.array.size > 0)
-        {
-            cjson_to_str_rec(element->value.array.elements[0], pretty, sb);
-        }
-        for (size_t i = 1; i < element->value.array.size; i++)
+        cjson_sink_write(sink, "[", 1);
+        cjson_sink_newline(sink, pretty, indent + 2);
+        for (size_t i = 0; i < element->value.array.size; i++)
         {
-            cjson_str_builder_append_char(sb, ',');
-            if (pretty)
+            if (i > 0)
             {
-                cjson_str_builder_append_char(sb, '\n');
-                for (size_t i = 0; i < indent; i++)
-                    cjson_str_builder_append_char(sb, ' ');
+                cjson_sink_write(sink, ",", 1);
+                cjson_sink_newline(sink, pretty, indent + 2);
             }
-            cjson_to_str_rec(element->value.array.elements[i], pretty, sb);
-        }
-        indent -= 2;
-        if (pretty)
-        {
-            cjson_str_builder_append_char(sb, '\n');
-            for (size_t i = 0; i < indent; i++)
-                cjson_str_builder_append_char(sb, ' ');
+            cjson_serialize(sink, element->value.array.elements[i], pretty, indent + 2);
         }
-        cjson_str_builder_append_char(sb, ']');
+        cjson_sink_newline(sink, pretty, indent);
+        cjson_sink_write(sink, "]", 1);
         break;
     case CJSON_OBJECT:
-        cjson_str_builder_append_char(sb, '{');
-        indent += 2;
-        if (pretty)
-        {
-            cjson_str_builder_append_char(sb, '\n');
-            for (size_t i = 0; i < indent; i++)
-                cjson_str_builder_append_char(sb, ' ');
-        }
+        cjson_sink_write(sink, "{", 1);
+        cjson_sink_newline(sink, pretty, indent + 2);
         cjson_object_iterator it = cjson_iterate_object(&element->value.object);
-        if (!it.end)
-        {
-            cjson_str_builder_append_char(sb, '"');
-            cjson_str_builder_append_cstr(sb, it.name);
-            cjson_str_builder_append_cstr(sb, "\":");
-            cjson_to_str_rec(it.element, pretty, sb);
-        }
-        for (cjson_iterate_next(&it); !it.end; cjson_iterate_next(&it))
+        for (bool first = true; !it.end; cjson_iterate_next(&it), first = false)
         {
-            cjson_str_builder_append_char(sb, ',');
-            if (pretty)
+            if (!first)
             {
-                cjson_str_builder_append_char(sb, '\n');
-                for (size_t i = 0; i < indent; i++)
-                    cjson_str_builder_append_char(sb, ' ');
+                cjson_sink_write(sink, ",", 1);
+                cjson_sink_newline(sink, pretty, indent + 2);
             }
-            cjson_str_builder_append_char(sb, '"');
-            cjson_str_builder_append_cstr(sb, it.name);
-            cjson_str_builder_append_cstr(sb, "\":");
-            cjson_to_str_rec(it.element, pretty, sb);
-        }
-        indent -= 2;
-        if (pretty)
-        {
-            cjson_str_builder_append_char(sb, '\n');
-            for (size_t i = 0; i < indent; i++)
-                cjson_str_builder_append_char(sb, ' ');
+            cjson_sink_string(sink, it.name);
+            cjson_sink_write(sink, ":", 1);
+            cjson_serialize(sink, it.element, pretty, indent + 2);
         }
-        cjson_str_builder_append_char(sb, '}');
+        cjson_sink_newline(sink, pretty, indent);
+        cjson_sink_write(sink, "}", 1);
         break;
     }
 }
 
+size_t cjson_serialized_size(cjson_element *element, int pretty)
+{
+    cjson_sink sink = { 0 };
+    cjson_serialize(&sink, element, pretty, 0);
+    return sink.total;
+}
+
+size_t cjson_to_buffer(cjson_element *element, char *buffer, size_t capacity, int pretty)
+{
+    // The last byte is kept for the NUL terminator
+    cjson_sink sink = {
+        .buffer = buffer,
+        .capacity = capacity == 0 ? 0 : capacity - 1,
+    };
+    cjson_serialize(&sink, element, pretty, 0);
+    if (capacity > 0)
+        buffer[sink.used] = '\0';
+    return sink.total;
+}
+
+static void cjson_grow_sink(cjson_sink *sink)
+{
+    sink->capacity *= 2;
+    sink->buffer = realloc(sink->buffer, sink->capacity);
+}
+
 char *cjson_to_str(cjson_element *element, int pretty)
 {
-    cjson_str_builder sb = { 0 };
-    cjson_to_str_rec(element, pretty, &sb);
-    cjson_str_builder_append_char(&sb, '\0');
-    return sb.str;
+    // Growing as needed formats every number once, unlike sizing first
+    cjson_sink sink = {
+        .buffer = malloc(256),
+        .capacity = 256,
+        .flush = cjson_grow_sink,
+    };
+    cjson_serialize(&sink, element, pretty, 0);
+    cjson_sink_write(&sink, "", 1);
+    return sink.buffer;
 }
 
-cjson_element *cjson_clone(cjson_element *element)
+static cjson_element *cjson_clone_in(cjson_arena *arena, cjson_element *element)
 {
     if (element == NULL)
         return NULL;
 
-    cjson_element *res = NULL;
+    cjson_element *res = cjson_new_element(arena, element->element_type);
     switch (element->element_type)
     {
     case CJSON_NULL:
     case CJSON_BOOL:
     case CJSON_INTEGER:
+    case CJSON_UNSIGNED:
     case CJSON_FLOAT:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = element->element_type;
         *res = *element;
         break;
-    case CJSON_STRING:
-        res = calloc(1, sizeof(cjson_element));
-        res->element_type = CJSON_STRING;
-        res->value.string.value = strdup(element->value.string.value);
-        break;
+    case CJSON_STRING: {
+            char *value = element->value.string.value;
+            res->value.string.value = cjson_strndup(arena, value, strlen(value));
+        } break;
     case CJSON_ARRAY: {
-            res = cjson_create_array();
             cjson_array *src_arr = cjson_as_array(element);
             cjson_array *dst_arr = cjson_as_array(res);
+            if (src_arr->size == 0)
+                break;
+            dst_arr->elements = arena == NULL
+                ? malloc(src_arr->size * sizeof(cjson_element *))
+                : cjson_arena_alloc(arena, src_arr->size * sizeof(cjson_element *));
             for (size_t i = 0; i < src_arr->size; i++)
-                cjson_array_append(dst_arr, cjson_clone(src_arr->elements[i]));
+                dst_arr->elements[i] = cjson_clone_in(arena, src_arr->elements[i]);
+            dst_arr->size = src_arr->size;
+            dst_arr->capacity = src_arr->size;
         } break;
     case CJSON_OBJECT: {
-            cjson_object *src_obj = cjson_as_object(element);
-            res = cjson_create_object(src_obj->members.capacity);
-            cjson_object *dst_obj = cjson_as_object(res);
-            cjson_object_iterator it = cjson_iterate_object(src_obj);
-            while (!it.end)
+            cjson_map *src_map = &cjson_as_object(element)->members;
+            cjson_map *dst_map = &res->value.object.members;
+            cjson_map_reserve(dst_map, arena, src_map->size);
+            for (size_t i = 0; i < src_map->size; i++)
             {
-                cjson_object_insert(dst_obj, it.name, cjson_clone(it.element));
-                it = cjson_iterate_next(&it);
+                cjson_map_item item = src_map->items[i];
+                item.name = cjson_strndup(arena, item.name, strlen(item.name));
+                item.element = cjson_clone_in(arena, item.element);
+                cjson_map_append(dst_map, item);
             }
         } break;
     }
     return res;
 }
 
-void cjson_dump(cjson_element *element, int pretty)
+cjson_element *cjson_clone(cjson_element *element)
 {
-    static size_t indent = 0;
-    switch (element->element_type)
+    return cjson_clone_in(NULL, element);
+}
+
+cjson_document *cjson_clone_document(cjson_element *element)
+{
+    cjson_document *document = calloc(1, sizeof(cjson_document));
+    document->root = cjson_clone_in(&document->arena, element);
+    return document;
+}
+
+#ifndef CJSON_WRITE_BUFFER
+#define CJSON_WRITE_BUFFER 65536
+#endif /* ! CJSON_WRITE_BUFFER */
+
+#ifndef CJSON_WRITE_IOV
+#define CJSON_WRITE_IOV 64
+#endif /* ! CJSON_WRITE_IOV */
+
+// shorter references are cheaper to copy than to give their own iovec
+#define CJSON_WRITE_REFERENCE_MIN 256
+
+/*
+ * Sink writing to a file descriptor. The output is gathered in iovecs that
+ * point either to the part of the buffer filled since the last iovec or to
+ * long strings of the document, and written with writev when the buffer or
+ * the iovecs run out.
+ */
+typedef struct
+{
+    cjson_sink sink;
+    int fd;
+    bool failed;
+    struct iovec iov[CJSON_WRITE_IOV];
+    int iov_count;
+    // start of the buffered bytes that are not in an iovec yet
+    size_t pending;
+} cjson_fd_sink;
+
+static void cjson_fd_sink_cut(cjson_fd_sink *fd_sink)
+{
+    cjson_sink *sink = &fd_sink->sink;
+    if (sink->used == fd_sink->pending)
+        return;
+    fd_sink->iov[fd_sink->iov_count].iov_base = sink->buffer + fd_sink->pending;
+    fd_sink->iov[fd_sink->iov_count].iov_len = sink->used - fd_sink->pending;
+    fd_sink->iov_count += 1;
+    fd_sink->pending = sink->used;
+}
+
+static void cjson_fd_sink_flush(cjson_sink *sink)
+{
+    cjson_fd_sink *fd_sink = (cjson_fd_sink *)sink;
+    cjson_fd_sink_cut(fd_sink);
+    struct iovec *iov = fd_sink->iov;
+    int count = fd_sink->iov_count;
+    while (count > 0 && !fd_sink->failed)
     {
-    case CJSON_NULL:
-        printf("null");
-        break;
-    case CJSON_BOOL:
-        if (element->value.boolean.value)
-            printf("true");
-        else
-            printf("false");
-        break;
-    case CJSON_INTEGER:
-        printf("%d", element->value.integer.value);
-        break;
-    case CJSON_FLOAT:
-        printf("%d", element->value.integer.value);
-        break;
-    case CJSON_STRING:
-        printf("\"%s\"", element->value.string.value);
-        break;
-    case CJSON_ARRAY:
-        putchar('[');
-        indent += 2;
-        cjson_pretty_newline(pretty, indent);
-        if (element->value.array.size > 0)
-        {
-            cjson_dump(element->value.array.elements[0], pretty);
-        }
-        for (size_t i = 1; i < element->value.array.size; i++)
+        ssize_t written = writev(fd_sink->fd, iov, count);
+        if (written < 0)
         {
-            putchar(',');
-            cjson_pretty_newline(pretty, indent);
-            cjson_dump(element->value.array.elements[i], pretty);
+            fd_sink->failed = errno != EINTR;
+            continue;
         }
-        indent -= 2;
-        cjson_pretty_newline(pretty, indent);
-        putchar(']');
-        break;
-    case CJSON_OBJECT:
-        putchar('{');
-        indent += 2;
-        cjson_pretty_newline(pretty, indent);
-        cjson_object_iterator it = cjson_iterate_object(&element->value.object);
-        if (!it.end)
+        // Skip what was written, a write may stop in the middle of an iovec
+        while (count > 0 && (size_t)written >= iov->iov_len)
         {
-            printf("\"%s\":", it.name);
-            cjson_dump(it.element, pretty);
+            written -= iov->iov_len;
+            iov += 1;
+            count -= 1;
         }
-        for (cjson_iterate_next(&it); !it.end; cjson_iterate_next(&it))
+        if (count > 0)
         {
-            putchar(',');
-            cjson_pretty_newline(pretty, indent);
-            printf("\"%s\":", it.name);
-            cjson_dump(it.element, pretty);
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
         }
-        indent -= 2;
-        cjson_pretty_newline(pretty, indent);
-        putchar('}');
-        break;
     }
+    fd_sink->iov_count = 0;
+    fd_sink->pending = 0;
+    sink->used = 0;
+}
+
+static void cjson_fd_sink_reference(cjson_sink *sink, const char *data, size_t len)
+{
+    cjson_fd_sink *fd_sink = (cjson_fd_sink *)sink;
+    if (len < CJSON_WRITE_REFERENCE_MIN)
+    {
+        cjson_sink_write(sink, data, len);
+        return;
+    }
+    // Room for the buffered bytes, the reference and what gets buffered after
+    // it until the next flush
+    if (fd_sink->iov_count + 3 > CJSON_WRITE_IOV)
+        cjson_fd_sink_flush(sink);
+    cjson_fd_sink_cut(fd_sink);
+    fd_sink->iov[fd_sink->iov_count].iov_base = (char *)data;
+    fd_sink->iov[fd_sink->iov_count].iov_len = len;
+    fd_sink->iov_count += 1;
+    sink->total += len;
+}
+
+int cjson_write_fd(cjson_element *element, int fd, int pretty)
+{
+    cjson_fd_sink fd_sink = {
+        .sink = {
+            .buffer = malloc(CJSON_WRITE_BUFFER),
+            .capacity = CJSON_WRITE_BUFFER,
+            .flush = cjson_fd_sink_flush,
+            .reference = cjson_fd_sink_reference,
+        },
+        .fd = fd,
+    };
+    cjson_serialize(&fd_sink.sink, element, pretty, 0);
+    cjson_fd_sink_flush(&fd_sink.sink);
+    free(fd_sink.sink.buffer);
+    return fd_sink.failed ? -1 : 0;
+}
+
+typedef struct
+{
+    cjson_sink sink;
+    FILE *file;
+} cjson_file_sink;
+
+static void cjson_file_sink_flush(cjson_sink *sink)
+{
+    cjson_file_sink *file_sink = (cjson_file_sink *)sink;
+    fwrite(sink->buffer, 1, sink->used, file_sink->file);
+    sink->used = 0;
+}
+
+int cjson_write_file(cjson_element *element, FILE *file, int pretty)
+{
+    // Streams backed by a descriptor skip stdio buffering once it is empty
+    int fd = fileno(file);
+    if (fd >= 0)
+    {
+        if (fflush(file) != 0)
+            return -1;
+        return cjson_write_fd(element, fd, pretty);
+    }
+
+    char buffer[4096];
+    cjson_file_sink file_sink = {
+        .sink = {
+            .buffer = buffer,
+            .capacity = sizeof(buffer),
+            .flush = cjson_file_sink_flush,
+        },
+        .file = file,
+    };
+    cjson_serialize(&file_sink.sink, element, pretty, 0);
+    cjson_file_sink_flush(&file_sink.sink);
+    return ferror(file) ? -1 : 0;
+}
+
+void cjson_dump(cjson_element *element, int pretty)
+{
+    cjson_write_file(element, stdout, pretty);
 }
 
 void cjson_delete(cjson_element *element)
@@ -1226,11 +7250,10 @@ void cjson_delete(cjson_element *element)
         {
             free(it.name);
             cjson_delete(it.element);
-            cjson_map_item *item = it.item;
             cjson_iterate_next(&it);
-            free(item);
         }
         free(element->value.object.members.items);
+        free(element->value.object.members.index);
     }
     free(element);
 }
@@ -0,0 +1,655 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#define CJSON_IMPLEMENTATION
+#include "../cjson.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief average time of a cjson_object_get on an object holding n keys made
+ *        with the given format
+ */
+static void bench_lookup(char *format, size_t n)
+{
+    char **keys = malloc(n * sizeof(char *));
+    cjson_element *elt = cjson_create_object(0);
+    cjson_object *obj = cjson_as_object(elt);
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), format, i);
+        keys[i] = strdup(buffer);
+        cjson_object_insert(obj, keys[i], cjson_create_integer(i));
+    }
+
+    size_t rounds = 10000000 / n;
+    size_t found = 0;
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+            found += cjson_object_get(obj, keys[i]) != NULL;
+    }
+    double elapsed = now() - start;
+    assert(found == rounds * n);
+    printf("lookup %-40s n=%-6zu %6.1f ns\n", format, n, elapsed * 1e9 / (rounds * n));
+
+    for (size_t i = 0; i < n; i++)
+        free(keys[i]);
+    free(keys);
+    cjson_delete(elt);
+}
+
+/**
+ * @brief builds an array of n log records looking like the ones we ingest
+ */
+static char *make_logs(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "%s{\"timestamp\": \"2024-03-01T12:%02zu:%02zu\", "
+                "\"level\": \"info\", \"service\": \"ingest-%zu\", "
+                "\"message\": \"request \\\"%zu\\\" served\", \"status\": 200}",
+                i == 0 ? "" : ",", i / 60 % 60, i % 60, i % 16, i);
+        cjson_str_builder_append_cstr(&sb, buffer);
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief builds a flat array of the n first integers
+ */
+static char *make_numbers(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%s%zu", i == 0 ? "" : ",", i);
+        cjson_str_builder_append_cstr(&sb, buffer);
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief builds an array of n [longitude, latitude] pairs
+ */
+static char *make_coordinates(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%s[%.6f,%.6f]", i == 0 ? "" : ",",
+                (double)(i * 7919 % 360000) / 1000 - 180, (double)(i * 104729 % 180000) / 1000 - 90);
+        cjson_str_builder_append_cstr(&sb, buffer);
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief builds an array of n strings of a few kilobytes
+ */
+static char *make_long_strings(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        cjson_str_builder_append_cstr(&sb, i == 0 ? "\"" : ",\"");
+        for (size_t j = 0; j < 1024 + i % 4096; j++)
+            cjson_str_builder_append_char(&sb, 'a' + (i + j) % 26);
+        cjson_str_builder_append_char(&sb, '"');
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief builds an array of n strings of mostly ASCII text with a few
+ *        multibyte characters
+ */
+static char *make_text(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "%s\"Le caf\xc3\xa9 n\xc2\xb0%zu co\xc3\xbbte 3 \xe2\x82\xac, "
+                "the rest of the sentence is plain ASCII text of a usual length\"",
+                i == 0 ? "" : ",", i);
+        cjson_str_builder_append_cstr(&sb, buffer);
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief builds an array of n arrays nested depth levels deep
+ */
+static char *make_nested(size_t n, size_t depth)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_char(&sb, '[');
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i != 0)
+            cjson_str_builder_append_char(&sb, ',');
+        for (size_t j = 0; j < depth; j++)
+            cjson_str_builder_append_cstr(&sb, j % 2 ? "[" : "{\"k\":");
+        cjson_str_builder_append_char(&sb, '1');
+        for (size_t j = depth; j > 0; j--)
+            cjson_str_builder_append_char(&sb, (j - 1) % 2 ? ']' : '}');
+    }
+    cjson_str_builder_append_char(&sb, ']');
+    cjson_str_builder_append_char(&sb, '\0');
+    return sb.str;
+}
+
+/**
+ * @brief average time of looking path up in the document parsed from input,
+ *        from the string and compiled once. input is freed
+ */
+static void bench_path(char *input, char *path)
+{
+    cjson_element *element = cjson_parse_str(input);
+    cjson_path *compiled = cjson_path_compile(path);
+    size_t rounds = 2000000;
+    size_t found = 0;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+        found += cjson_get_element_from(element, path) != NULL;
+    double string = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        found += cjson_path_eval(compiled, element) != NULL;
+    double eval = now() - start;
+
+    assert(found == 2 * rounds);
+
+    printf("path %-35s string %6.1f ns  compiled %6.1f ns\n", path, string * 1e9 / rounds,
+            eval * 1e9 / rounds);
+    cjson_path_delete(compiled);
+    cjson_delete(element);
+    free(input);
+}
+
+/**
+ * @brief average time of getting n of the fields of a wide record nested under
+ *        a few levels, path by path and with a path set
+ */
+static void bench_project(size_t n)
+{
+    cjson_str_builder sb = { 0 };
+    cjson_str_builder_append_cstr(&sb, "{\"event\": {\"payload\": {\"record\": {");
+    for (size_t i = 0; i < 100; i++)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%s\"field_%03zu\": %zu", i == 0 ? "" : ", ", i, i);
+        cjson_str_builder_append_cstr(&sb, buffer);
+    }
+    cjson_str_builder_append_cstr(&sb, "}}}}");
+    cjson_str_builder_append_char(&sb, '\0');
+    cjson_element *element = cjson_parse_str(sb.str);
+    free(sb.str);
+
+    cjson_path **paths = malloc(n * sizeof(cjson_path *));
+    for (size_t i = 0; i < n; i++)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), ".event.payload.record.field_%03zu", i * 7 % 100);
+        paths[i] = cjson_path_compile(buffer);
+    }
+    cjson_path_set *set = cjson_path_set_new(paths, n);
+    cjson_element **out = malloc(n * sizeof(cjson_element *));
+    size_t rounds = 10000000 / n;
+    int64_t sums[2] = { 0, 0 };
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+            sums[0] += cjson_as_int64(cjson_path_eval(paths[i], element));
+    }
+    double each = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_path_set_eval(set, element, out);
+        for (size_t i = 0; i < n; i++)
+            sums[1] += cjson_as_int64(out[i]);
+    }
+    double batch = now() - start;
+
+    assert(sums[0] == sums[1]);
+    printf("project %-3zu fields  each %6.1f ns  set %6.1f ns\n", n, each * 1e9 / rounds,
+            batch * 1e9 / rounds);
+    for (size_t i = 0; i < n; i++)
+        cjson_path_delete(paths[i]);
+    free(paths);
+    free(out);
+    cjson_path_set_delete(set);
+    cjson_delete(element);
+}
+
+/**
+ * @brief average time per result of running a JSONPath expression over the
+ *        document parsed from input, which is not freed
+ */
+static void bench_query(char *input, char *expression)
+{
+    cjson_element *element = cjson_parse_str(input);
+    cjson_query *query = cjson_query_compile(expression);
+    cjson_query_iterator *iterator = cjson_query_run(query, element);
+    size_t rounds = 20;
+    size_t results = 0;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_query_rewind(iterator, element);
+        while (cjson_query_next(iterator) != NULL)
+            results++;
+    }
+    double elapsed = now() - start;
+
+    printf("query %-34s %8zu results %6.1f ns each\n", expression, results / rounds,
+            elapsed * 1e9 / results);
+    cjson_query_iterator_delete(iterator);
+    cjson_query_delete(query);
+    cjson_delete(element);
+}
+
+static bool count_result(void *ctx, cjson_element *result)
+{
+    (void)result;
+    (*(size_t *)ctx)++;
+    return true;
+}
+
+/**
+ * @brief throughput of running a JSONPath expression over input by parsing it
+ *        and iterating over the results, and by streaming it. input is not
+ *        freed
+ */
+static void bench_stream(char *name, char *input, char *expression)
+{
+    size_t len = strlen(input);
+    size_t rounds = 20000000 / len + 1;
+    cjson_query *query = cjson_query_compile(expression);
+    size_t results[2] = { 0, 0 };
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_element *element = cjson_parse_n(input, len, NULL);
+        cjson_query_iterator *iterator = cjson_query_run(query, element);
+        while (cjson_query_next(iterator) != NULL)
+            results[0]++;
+        cjson_query_iterator_delete(iterator);
+        cjson_delete(element);
+    }
+    double tree = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_query_stream(query, input, len, count_result, &results[1]);
+    double stream = now() - start;
+
+    assert(results[0] == results[1]);
+    double mb = len * rounds / 1e6;
+    printf("stream %-15s %-30s tree %6.1f MB/s  stream %6.1f MB/s\n", name, expression,
+            mb / tree, mb / stream);
+    cjson_query_delete(query);
+}
+
+/**
+ * @brief parse throughput of the heap, document, in-situ and push parsers over
+ *        input, which is freed
+ */
+static void bench_parse(char *name, char *input)
+{
+    size_t len = strlen(input);
+    char *copy = malloc(len + 1);
+    size_t rounds = 20000000 / len + 1;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_delete(cjson_parse_str(input));
+    double heap = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_document_delete(cjson_parse_document(input));
+    double document = now() - start;
+
+    // In-situ parsing overwrites its input, restoring it is counted too
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        memcpy(copy, input, len + 1);
+        cjson_document_delete(cjson_parse_insitu(copy, len));
+    }
+    double insitu = now() - start;
+
+    // Fed the way a socket would deliver it
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_parser *parser = cjson_parser_new(NULL);
+        for (size_t i = 0; i < len; i += 4096)
+            cjson_parser_feed(parser, input + i, len - i < 4096 ? len - i : 4096);
+        cjson_delete(cjson_parser_finish(parser));
+    }
+    double push = now() - start;
+
+    double mb = len * rounds / 1e6;
+    printf("parse %-16s heap %6.1f MB/s  document %6.1f MB/s  insitu %6.1f MB/s  "
+            "push %6.1f MB/s\n", name, mb / heap, mb / document, mb / insitu, mb / push);
+    free(copy);
+    free(input);
+}
+
+/**
+ * @brief cjson_parse_n throughput over input with and without UTF-8
+ *        validation, input is freed
+ */
+static void bench_validate(char *name, char *input)
+{
+    size_t len = strlen(input);
+    size_t rounds = 20000000 / len + 1;
+    cjson_parse_options options = { .validate_utf8 = true };
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_delete(cjson_parse_n(input, len, NULL));
+    double plain = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_delete(cjson_parse_n(input, len, &options));
+    double validated = now() - start;
+
+    double mb = len * rounds / 1e6;
+    printf("parse %-16s plain %6.1f MB/s  utf-8 validated %6.1f MB/s\n", name,
+            mb / plain, mb / validated);
+    free(input);
+}
+
+static bool count_value(void *ctx)
+{
+    (*(size_t *)ctx)++;
+    return true;
+}
+
+static bool count_string(void *ctx, const char *str, size_t len)
+{
+    (void)str;
+    (void)len;
+    return count_value(ctx);
+}
+
+/**
+ * @brief throughput of counting the strings and nulls of input from its parse
+ *        events against building its elements, input is freed
+ */
+static void bench_events(char *name, char *input)
+{
+    size_t len = strlen(input);
+    size_t rounds = 20000000 / len + 1;
+    cjson_handler handler = { .null = count_value, .string = count_string };
+    size_t count = 0;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_delete(cjson_parse_n(input, len, NULL));
+    double tree = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_parse_events(input, len, &handler, &count, NULL);
+    double events = now() - start;
+
+    double mb = len * rounds / 1e6;
+    printf("scan %-17s tree %6.1f MB/s  events %6.1f MB/s\n", name, mb / tree, mb / events);
+    free(input);
+}
+
+/**
+ * @brief sums the integer member key of the objects of an array with a pull
+ *        reader, skipping every other value
+ */
+static int64_t sum_member(cjson_reader *reader, const char *key)
+{
+    int64_t sum = 0;
+    size_t key_len = strlen(key);
+    cjson_reader_next(reader);
+    while (cjson_reader_next(reader) == CJSON_READ_START_OBJECT)
+    {
+        while (cjson_reader_next(reader) == CJSON_READ_KEY)
+        {
+            size_t len;
+            const char *name = cjson_reader_get_string(reader, &len);
+            if (len == key_len && memcmp(name, key, len) == 0
+                    && cjson_reader_next(reader) == CJSON_READ_INTEGER)
+                sum += cjson_reader_get_int64(reader);
+            else
+                cjson_reader_skip_value(reader);
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief throughput of summing the integer member key of the objects of input
+ *        with a pull reader against parsing it and looking the key up, input
+ *        is freed
+ */
+static void bench_reader(char *name, char *input, char *key)
+{
+    size_t len = strlen(input);
+    size_t rounds = 20000000 / len + 1;
+    int64_t sums[2] = { 0, 0 };
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_element *element = cjson_parse_n(input, len, NULL);
+        cjson_array *array = cjson_as_array(element);
+        for (size_t i = 0; i < array->size; i++)
+            sums[0] += cjson_as_int64(cjson_object_get(cjson_as_object(array->elements[i]), key));
+        cjson_delete(element);
+    }
+    double tree = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_reader *reader = cjson_reader_new(input, len, NULL);
+        sums[1] += sum_member(reader, key);
+        cjson_reader_delete(reader);
+    }
+    double reader = now() - start;
+
+    assert(sums[0] == sums[1]);
+    double mb = len * rounds / 1e6;
+    printf("sum %-18s tree %6.1f MB/s  reader %6.1f MB/s\n", name, mb / tree, mb / reader);
+    free(input);
+}
+
+/**
+ * @brief throughput of a pull reader skipping input, given as the first member
+ *        of an object, to read the member after it. input is freed
+ */
+static void bench_skip(char *name, char *input)
+{
+    size_t len = strlen(input) + 32;
+    char *document = malloc(len);
+    len = snprintf(document, len, "{\"skipped\": %s, \"id\": 42}", input);
+    size_t rounds = 200000000 / len + 1;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_reader *reader = cjson_reader_new(document, len, NULL);
+        cjson_reader_next(reader);
+        cjson_reader_next(reader);
+        cjson_reader_skip_value(reader);
+        cjson_reader_next(reader);
+        cjson_reader_next(reader);
+        assert(cjson_reader_get_int64(reader) == 42);
+        cjson_reader_delete(reader);
+    }
+    double elapsed = now() - start;
+
+    printf("skip %-17s %6.2f GB/s\n", name, len * rounds / elapsed / 1e9);
+    free(document);
+    free(input);
+}
+
+/**
+ * @brief throughput of getting two members out of an object holding input,
+ *        by parsing it whole and by parsing only their paths. input is freed
+ */
+static void bench_select(char *name, char *input)
+{
+    size_t len = strlen(input) + 64;
+    char *document = malloc(len);
+    len = snprintf(document, len, "{\"data\": %s, \"id\": 42, \"tags\": [\"a\", \"b\"]}", input);
+    size_t rounds = 20000000 / len + 1;
+    char *paths[] = { ".id", ".tags[1]" };
+    int64_t sums[2] = { 0, 0 };
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_element *element = cjson_parse_n(document, len, NULL);
+        sums[0] += cjson_as_int64(cjson_get_element_from(element, paths[0]));
+        sums[0] += cjson_as_string(cjson_get_element_from(element, paths[1]))[0];
+        cjson_delete(element);
+    }
+    double tree = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        cjson_element *element = cjson_parse_select(document, len, paths, 2);
+        sums[1] += cjson_as_int64(cjson_get_element_from(element, paths[0]));
+        sums[1] += cjson_as_string(cjson_get_element_from(element, paths[1]))[0];
+        cjson_delete(element);
+    }
+    double select = now() - start;
+
+    assert(sums[0] == sums[1]);
+    double mb = len * rounds / 1e6;
+    printf("select %-15s tree %6.1f MB/s  select %6.1f MB/s\n", name, mb / tree, mb / select);
+    free(document);
+    free(input);
+}
+
+/**
+ * @brief cjson_to_str, cjson_to_buffer and cjson_write_fd to /dev/null throughput over the
+ *        document parsed from input, which is freed
+ */
+static void bench_serialize(char *name, char *input)
+{
+    cjson_element *element = cjson_parse_str(input);
+    size_t len = strlen(input);
+    size_t rounds = 20000000 / len + 1;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++)
+        free(cjson_to_str(element, 0));
+    double to_str = now() - start;
+
+    size_t size = cjson_serialized_size(element, 0);
+    char *buffer = malloc(size + 1);
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_to_buffer(element, buffer, size + 1, 0);
+    double to_buffer = now() - start;
+
+    int fd = open("/dev/null", O_WRONLY);
+    start = now();
+    for (size_t r = 0; r < rounds; r++)
+        cjson_write_fd(element, fd, 0);
+    double write_fd = now() - start;
+    close(fd);
+
+    double mb = len * rounds / 1e6;
+    printf("serialize %-15s to_str %6.1f MB/s  to_buffer %6.1f MB/s  write_fd %6.1f MB/s\n",
+            name, mb / to_str, mb / to_buffer, mb / write_fd);
+    free(buffer);
+    cjson_delete(element);
+    free(input);
+}
+
+int main()
+{
+    size_t sizes[] = { 8, 1000, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        bench_lookup("field_%03zu", sizes[i]);
+        bench_lookup("%zu", sizes[i]);
+        bench_lookup("com.example.service.request.header.%zu", sizes[i]);
+        bench_lookup("%zu.com.example.service.request.header", sizes[i]);
+    }
+    bench_path(make_logs(100), "[42].service");
+    bench_path(make_nested(4, 16), "[3].k[0].k[0].k[0].k[0].k[0].k[0].k[0].k");
+    bench_project(4);
+    bench_project(32);
+    char *logs = make_logs(100000);
+    bench_query(logs, "$[*].status");
+    bench_query(logs, "$[::-2].service");
+    bench_query(logs, "$[?(@.service == 'ingest-3')].timestamp");
+    bench_query(logs, "$..status");
+    bench_stream("logs 100000", logs, "$[*].status");
+    bench_stream("logs 100000", logs, "$[?(@.status == 200)].level");
+    bench_stream("logs 100000", logs, "$..service");
+    free(logs);
+    bench_parse("logs 100", make_logs(100));
+    bench_parse("logs 100000", make_logs(100000));
+    bench_parse("numbers 100000", make_numbers(100000));
+    bench_parse("coordinates", make_coordinates(100000));
+    bench_parse("nested 64", make_nested(10000, 64));
+    bench_validate("logs 100000", make_logs(100000));
+    bench_validate("text 100000", make_text(100000));
+    bench_validate("long strings", make_long_strings(10000));
+    bench_events("logs 100000", make_logs(100000));
+    bench_events("coordinates", make_coordinates(100000));
+    bench_events("long strings", make_long_strings(10000));
+    bench_reader("logs 100000", make_logs(100000), "status");
+    bench_skip("logs 100000", make_logs(100000));
+    bench_skip("nested 64", make_nested(10000, 64));
+    bench_skip("long strings", make_long_strings(10000));
+    bench_select("logs 100000", make_logs(100000));
+    bench_select("numbers 100000", make_numbers(100000));
+    bench_serialize("logs 100000", make_logs(100000));
+    bench_serialize("numbers 100000", make_numbers(100000));
+    bench_serialize("coordinates", make_coordinates(100000));
+    bench_serialize("long strings", make_long_strings(10000));
+    return 0;
+}
@@ -1,6 +1,110 @@
-#include <stdio.h>
+// The implementation comes first, its feature macro must precede system headers
 #define CJSON_IMPLEMENTATION
 #include "../cjson.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+static bool ignore_result(void *ctx, cjson_element *result)
+{
+    (void)ctx;
+    (void)result;
+    return true;
+}
+
+/*
+ * Results of a query, serialized and separated by spaces
+ */
+typedef struct
+{
+    char text[1024];
+    size_t size;
+} query_output;
+
+static bool append_result(void *ctx, cjson_element *result)
+{
+    query_output *output = ctx;
+    char *str = cjson_to_str(result, 0);
+    output->size += snprintf(output->text + output->size, sizeof(output->text) - output->size,
+            "%s%s", output->size > 0 ? " " : "", str);
+    free(str);
+    return true;
+}
+
+/**
+ * @brief returns true if the results of expression from element are those of
+ *        expected, in this order
+ */
+static bool query_gives(const char *expression, cjson_element *element, const char *expected)
+{
+    cjson_query *query = cjson_query_compile(expression);
+    assert(query != NULL);
+    query_output output = { .text = "", .size = 0 };
+    cjson_query_iterator *iterator = cjson_query_run(query, element);
+    cjson_element *result;
+    while ((result = cjson_query_next(iterator)) != NULL)
+        append_result(&output, result);
+    cjson_query_iterator_delete(iterator);
+    cjson_query_delete(query);
+    if (strcmp(output.text, expected) != 0)
+        printf("%s gave %s\n", expression, output.text);
+    return strcmp(output.text, expected) == 0;
+}
+
+/*
+ * Results of a query, serialized in the order they came
+ */
+typedef struct
+{
+    char *results[64];
+    size_t size;
+} result_list;
+
+static bool collect_result(void *ctx, cjson_element *result)
+{
+    result_list *list = ctx;
+    assert(list->size < sizeof(list->results) / sizeof(list->results[0]));
+    list->results[list->size++] = cjson_to_str(result, 0);
+    return true;
+}
+
+static int compare_results(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief returns true if streaming expression over json gives the same
+ *        results as running it over the parsed document, in any order
+ */
+static bool stream_matches_run(const char *expression, const char *json)
+{
+    cjson_query *query = cjson_query_compile(expression);
+    assert(query != NULL);
+    result_list streamed = { .size = 0 };
+    assert(cjson_query_stream(query, json, strlen(json), collect_result, &streamed) == 0);
+    result_list run = { .size = 0 };
+    cjson_element *element = cjson_parse_n(json, strlen(json), NULL);
+    cjson_query_iterator *iterator = cjson_query_run(query, element);
+    cjson_element *result;
+    while ((result = cjson_query_next(iterator)) != NULL)
+        collect_result(&run, result);
+    cjson_query_iterator_delete(iterator);
+    cjson_delete(element);
+    cjson_query_delete(query);
+
+    qsort(streamed.results, streamed.size, sizeof(char *), compare_results);
+    qsort(run.results, run.size, sizeof(char *), compare_results);
+    bool res = streamed.size == run.size && run.size > 0;
+    for (size_t i = 0; i < run.size; i++)
+    {
+        if (res && strcmp(streamed.results[i], run.results[i]) != 0)
+            res = false;
+        free(run.results[i]);
+    }
+    for (size_t i = 0; i < streamed.size; i++)
+        free(streamed.results[i]);
+    return res;
+}
 
 int main()
 {
@@ -11,11 +115,28 @@ int main()
     assert(elt2);
     printf("Value of `test': %d\n", cjson_as_integer(elt2));
 
+    cjson_element *ids = cjson_parse_str("[1700000000123456789, 18446744073709551615]");
+    cjson_array *ids_array = cjson_as_array(ids);
+    printf("64-bit values: %" PRId64 " %" PRIu64 "\n", cjson_as_int64(ids_array->elements[0]),
+            cjson_as_uint64(ids_array->elements[1]));
+    cjson_delete(ids);
+
     char *input2 = "{\"test\": { \"test2\": [1,2, {\"test3\": 4, \"test4\": 5}]}}";
     cjson_element *element2 = cjson_parse_str(input2);
     cjson_element *t3 = cjson_get_element_from(element2, ".test.test2[2].test3");
     printf("Value of `test.test2[2].test3': %d\n", cjson_as_integer(t3));
 
+    cjson_document *document = cjson_parse_document(input2);
+    cjson_element *t4 = cjson_get_element_from(cjson_document_root(document), ".test.test2[2].test4");
+    printf("Value of `test.test2[2].test4': %d\n", cjson_as_integer(t4));
+    cjson_document_delete(document);
+
+    char buffer[] = "{\"name\": \"in\\tplace\", \"tags\": [\"a\", \"b\"]}";
+    cjson_document *insitu = cjson_parse_insitu(buffer, sizeof(buffer) - 1);
+    cjson_element *name = cjson_get_element_from(cjson_document_root(insitu), ".name");
+    printf("Value of `name': %s\n", cjson_as_string(name));
+    cjson_document_delete(insitu);
+
     char *input3 = "{"
         "\"glossary\": {"
         "\"title\": \"example glossary\","
@@ -46,6 +167,18 @@ int main()
     char *dump = cjson_to_str(element3, 0);
     puts(dump);
 
+    // Output buffered in the stream comes before what goes to its descriptor
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    fputs("> ", file);
+    assert(cjson_write_file(element3, file, 0) == 0);
+    rewind(file);
+    char written[4096];
+    size_t written_len = fread(written, 1, sizeof(written) - 1, file);
+    written[written_len] = '\0';
+    assert(strncmp(written, "> ", 2) == 0 && strcmp(written + 2, dump) == 0);
+    fclose(file);
+
     cjson_delete(element);
     cjson_delete(element2);
     cjson_delete(element3);
@@ -74,6 +207,118 @@ int main()
     cjson_dump(clone, 1);
     cjson_delete(clone);
 
+    // Only whitespace may follow the value, a NUL byte within the length is
+    // not the end
+    struct
+    {
+        char *str;
+        size_t len;
+    } trailing[] = {
+        { "[1] x", 5 }, { "1 2", 3 }, { "{\"a\":1}}", 8 }, { "3]", 2 },
+        { "\"a\" \"b\"", 7 }, { "[1][2]", 6 }, { "1\0x", 3 }, { "[1,2]\0", 6 },
+    };
+    for (size_t i = 0; i < sizeof(trailing) / sizeof(trailing[0]); i++)
+    {
+        char *str = trailing[i].str;
+        size_t len = trailing[i].len;
+        assert(cjson_parse_n(str, len, NULL) == NULL);
+        cjson_handler handler = { 0 };
+        assert(cjson_parse_events(str, len, &handler, NULL, NULL) == -1);
+        cjson_reader *reader = cjson_reader_new(str, len, NULL);
+        int event;
+        while ((event = cjson_reader_next(reader)) > CJSON_READ_END)
+            ;
+        assert(event == CJSON_READ_ERROR);
+        cjson_reader_delete(reader);
+        char *all[] = { "" };
+        assert(cjson_parse_select(str, len, all, 1) == NULL);
+        cjson_query *query = cjson_query_compile("$..*");
+        assert(cjson_query_stream(query, str, len, ignore_result, NULL) == -1);
+        cjson_query_delete(query);
+    }
+    cjson_element *spaced = cjson_parse_str(" [1] \n");
+    assert(spaced != NULL);
+    cjson_delete(spaced);
+
+    // Filters only compare with scalars
+    assert(cjson_query_compile("$[?(@.a == [])]") == NULL);
+    assert(cjson_query_compile("$[?(@.a == {})]") == NULL);
+    assert(cjson_query_compile("$[::-9223372036854775808]") == NULL);
+
+    cjson_element *doc = cjson_parse_str("{\"n\": [0, 1, 2, 3, 4, 5, 6],"
+            "\"a\": {\"b\": [{\"c\": 1}, {\"c\": 5, \"d\": null}], \"c\": \"x\"},"
+            "\"s\": [{\"p\": 3, \"q\": \"a\"}, {\"p\": 10}, {\"q\": \"b\"}]}");
+    // Slices, backwards with a negative step
+    assert(query_gives("$.n[5:1:-2]", doc, "5 3"));
+    assert(query_gives("$.n[::-3]", doc, "6 3 0"));
+    assert(query_gives("$.n[1:3]", doc, "1 2"));
+    assert(query_gives("$.n[-2:]", doc, "5 6"));
+    assert(query_gives("$.n[4:100]", doc, "4 5 6"));
+    assert(query_gives("$.n[3:1]", doc, ""));
+    // Indices, counted from the end when negative
+    assert(query_gives("$.n[-1]", doc, "6"));
+    assert(query_gives("$.n[-7]", doc, "0"));
+    assert(query_gives("$.n[-8]", doc, ""));
+    assert(query_gives("$.n[7]", doc, ""));
+    assert(query_gives("$.a[0]", doc, ""));
+    // An element comes before its descendants
+    assert(query_gives("$..c", doc, "\"x\" 1 5"));
+    assert(query_gives("$..[1]", doc, "1 {\"c\":5,\"d\":null} {\"p\":10}"));
+    assert(query_gives("$.a..*", doc, "[{\"c\":1},{\"c\":5,\"d\":null}] \"x\" "
+                "{\"c\":1} {\"c\":5,\"d\":null} 1 5 null"));
+    // Comparison and existence filters
+    assert(query_gives("$.s[?(@.p > 3)]", doc, "{\"p\":10}"));
+    assert(query_gives("$.s[?(@.p <= 3)]", doc, "{\"p\":3,\"q\":\"a\"}"));
+    assert(query_gives("$.s[?(@.q == 'b')]", doc, "{\"q\":\"b\"}"));
+    assert(query_gives("$.s[?(@.q)].q", doc, "\"a\" \"b\""));
+    assert(query_gives("$.a.b[?(@.d == null)].c", doc, "5"));
+    assert(query_gives("$.n[?(@ >= 5)]", doc, "5 6"));
+    cjson_delete(doc);
+
+    // Streaming gives the same results, filters and indices from the end
+    // through the values they buffer
+    char *streamed = "{\"n\": [0, 1, 2, 3], \"a\": [{\"c\": [1, {\"c\": 2}]}, {\"c\": 3, \"d\": 1}],"
+            "\"s\": [{\"p\": 3}, {\"p\": 10, \"c\": [4, 5]}]}";
+    assert(stream_matches_run("$..[1]", streamed));
+    assert(stream_matches_run("$..c", streamed));
+    assert(stream_matches_run("$..*", streamed));
+    assert(stream_matches_run("$.n[-2]", streamed));
+    assert(stream_matches_run("$..[-1]", streamed));
+    assert(stream_matches_run("$.s[?(@.p >= 3)].p", streamed));
+    assert(stream_matches_run("$..[?(@.d)].c", streamed));
+
+    // Chunks cut anywhere, even inside a string, a number or an escape, parse
+    // like the whole input
+    char *chunked = "{\"caf\\u00e9\": [\"tab\\t\\\"quoted\\\"\", \"\\ud83d\\ude00\", \"\\/\\\\\"],"
+            " \"n\": [-12.5e-3, 6.02E+23, 1e2, 0, -0.0, 18446744073709551615, -9223372036854775808],"
+            " \"k\": [true, false, null, {}, []]}";
+    size_t chunked_len = strlen(chunked);
+    cjson_element *whole = cjson_parse_n(chunked, chunked_len, NULL);
+    assert(whole != NULL);
+    char *expected = cjson_to_str(whole, 0);
+    cjson_delete(whole);
+    for (size_t cut = 0; cut <= chunked_len; cut++)
+    {
+        cjson_parser *parser = cjson_parser_new(NULL);
+        assert(cjson_parser_feed(parser, chunked, cut) == 0);
+        assert(cjson_parser_feed(parser, chunked + cut, chunked_len - cut) == 0);
+        cjson_element *pushed = cjson_parser_finish(parser);
+        assert(pushed != NULL);
+        char *pushed_str = cjson_to_str(pushed, 0);
+        assert(strcmp(pushed_str, expected) == 0);
+        free(pushed_str);
+        cjson_delete(pushed);
+    }
+    cjson_parser *bytes = cjson_parser_new(NULL);
+    for (size_t i = 0; i < chunked_len; i++)
+        assert(cjson_parser_feed(bytes, chunked + i, 1) == 0);
+    cjson_element *pushed = cjson_parser_finish(bytes);
+    char *pushed_str = cjson_to_str(pushed, 0);
+    assert(strcmp(pushed_str, expected) == 0);
+    free(pushed_str);
+    cjson_delete(pushed);
+    free(expected);
+
     char *test = "\"\\u00e9\"";
     cjson_element *testelt = cjson_parse_str(test);
     cjson_dump(testelt, 0);